@@ -17,6 +17,14 @@ namespace py = pybind11;
 using namespace pybind11::literals;
 
 
+// Row-major matrix of IDs exposing the buffer protocol, e.g. for numpy.asarray.
+struct IdsMatrix
+{
+  std::vector<int32_t> ids;
+  size_t rows = 0;
+  size_t cols = 0;
+};
+
 class TokenizerWrapper
 {
 public:
@@ -37,6 +45,7 @@ public:
                    const std::optional<std::string>& sp_model_path,
                    int sp_nbest_size,
                    float sp_alpha,
+                   size_t subword_cache_size,
                    const std::string& joiner,
                    bool joiner_annotate,
                    bool joiner_new,
@@ -96,6 +105,7 @@ public:
         subword_encoder->load_vocabulary(vocabulary_path.value(), vocabulary_threshold, &options);
       else if (bpe_vocab_path)  // Backward compatibility.
         subword_encoder->load_vocabulary(bpe_vocab_path.value(), bpe_vocab_threshold, &options);
+      subword_encoder->set_cache_size(subword_cache_size);
     }
 
     _tokenizer = std::make_shared<onmt::Tokenizer>(options, subword_encoder);
@@ -130,6 +140,15 @@ public:
       );
   }
 
+  py::dict get_subword_cache_stats() const
+  {
+    const auto& subword_encoder = _tokenizer->get_subword_encoder();
+    const auto stats = (subword_encoder
+                        ? subword_encoder->get_cache_stats()
+                        : onmt::SubwordEncoder::CacheStats());
+    return py::dict("hits"_a=stats.hits, "misses"_a=stats.misses);
+  }
+
   std::vector<std::string> call(const std::string& text, const bool training) const
   {
     std::vector<std::string> tokens;
@@ -157,20 +176,58 @@ public:
     std::vector<std::vector<onmt::Token>>>
   tokenize_batch(const std::vector<std::string>& batch_text,
                  const bool as_token_objects,
-                 const bool training) const {
+                 const bool training,
+                 const size_t num_threads) const {
     const size_t batch_size = batch_text.size();
 
-    std::vector<std::vector<onmt::Token>> batch_tokens(batch_size);
-    for (size_t i = 0; i < batch_size; ++i)
-      _tokenizer->tokenize(batch_text[i], batch_tokens[i], training);
-    if (as_token_objects)
+    if (as_token_objects) {
+      std::vector<std::vector<onmt::Token>> batch_tokens;
+      _tokenizer->tokenize_batch(batch_text, batch_tokens, num_threads, training);
       return std::move(batch_tokens);
+    }
 
-    std::vector<std::vector<std::string>> batch_words(batch_size);
-    std::vector<std::optional<std::vector<std::vector<std::string>>>> batch_features(batch_size);
-    for (size_t i = 0; i < batch_size; ++i)
-      std::tie(batch_words[i], batch_features[i]) = serialize_tokens(batch_tokens[i]);
-    return std::make_pair(std::move(batch_words), std::move(batch_features));
+    std::vector<std::vector<std::string>> batch_words;
+    std::vector<std::vector<std::vector<std::string>>> batch_features;
+    _tokenizer->tokenize_batch(batch_text, batch_words, batch_features, num_threads, training);
+
+    std::vector<std::optional<std::vector<std::vector<std::string>>>> optional_features(batch_size);
+    for (size_t i = 0; i < batch_size; ++i) {
+      if (!batch_features[i].empty())
+        optional_features[i] = std::move(batch_features[i]);
+    }
+    return std::make_pair(std::move(batch_words), std::move(optional_features));
+  }
+
+  template <typename VocabType>
+  std::vector<int32_t> tokenize_to_ids(const std::string& text,
+                                       const VocabType& vocab,
+                                       const bool training) const
+  {
+    std::vector<int32_t> ids;
+    _tokenizer->tokenize_to_ids(text, vocab, ids, training);
+    return ids;
+  }
+
+  template <typename VocabType>
+  std::pair<IdsMatrix, std::vector<size_t>>
+  tokenize_batch_to_ids(const std::vector<std::string>& batch_text,
+                        const VocabType& vocab,
+                        const int32_t padding_id,
+                        const bool training,
+                        const size_t num_threads) const
+  {
+    IdsMatrix matrix;
+    std::vector<size_t> lengths;
+    _tokenizer->tokenize_batch_to_ids(batch_text,
+                                      vocab,
+                                      matrix.ids,
+                                      lengths,
+                                      padding_id,
+                                      num_threads,
+                                      training);
+    matrix.rows = batch_text.size();
+    matrix.cols = matrix.rows > 0 ? matrix.ids.size() / matrix.rows : 0;
+    return std::make_pair(std::move(matrix), std::move(lengths));
   }
 
   std::pair<std::vector<std::string>, std::optional<std::vector<std::vector<std::string>>>>
@@ -243,26 +300,20 @@ public:
                      bool training,
                      const std::string& tokens_delimiter)
   {
-    std::ifstream in(input_path);
-    if (!in)
-      throw std::invalid_argument("Failed to open input file " + input_path);
-    std::ofstream out(output_path);
-    if (!out)
-      throw std::invalid_argument("Failed to open output file " + output_path);
-    _tokenizer->tokenize_stream(in, out, num_threads, verbose, training, tokens_delimiter);
+    _tokenizer->tokenize_file(input_path,
+                              output_path,
+                              num_threads,
+                              verbose,
+                              training,
+                              tokens_delimiter);
   }
 
   void detokenize_file(const std::string& input_path,
                        const std::string& output_path,
-                       const std::string& tokens_delimiter)
+                       const std::string& tokens_delimiter,
+                       int num_threads)
   {
-    std::ifstream in(input_path);
-    if (!in)
-      throw std::invalid_argument("Failed to open input file " + input_path);
-    std::ofstream out(output_path);
-    if (!out)
-      throw std::invalid_argument("Failed to open output file " + output_path);
-    _tokenizer->detokenize_stream(in, out, tokens_delimiter);
+    _tokenizer->detokenize_file(input_path, output_path, tokens_delimiter, num_threads);
   }
 
   const std::shared_ptr<const onmt::Tokenizer>& get() const
@@ -370,13 +421,17 @@ public:
   BPELearnerWrapper(const std::optional<TokenizerWrapper>& tokenizer,
                     int symbols,
                     int min_frequency,
-                    bool total_symbols)
+                    bool total_symbols,
+                    size_t num_threads,
+                    size_t max_vocab_size)
     : SubwordLearnerWrapper(tokenizer,
                             std::make_unique<onmt::BPELearner>(false,
                                                                symbols,
                                                                min_frequency,
                                                                false,
-                                                               total_symbols))
+                                                               total_symbols,
+                                                               num_threads,
+                                                               max_vocab_size))
   {
   }
 
@@ -397,15 +452,12 @@ static std::unordered_map<std::string, std::string> parse_kwargs(py::kwargs kwar
   return map;
 }
 
-static std::string create_temp_file()
+// The training option num_threads is also used to ingest files.
+static size_t get_num_threads(const py::kwargs& kwargs)
 {
-  py::object tempfile = py::module::import("tempfile");
-  py::object mkstemp = tempfile.attr("mkstemp");
-  py::tuple output = mkstemp();
-  auto fd = output[0].cast<int>();
-  auto filename = output[1].cast<std::string>();
-  close(fd);
-  return filename;
+  if (!kwargs.contains("num_threads"))
+    return 1;
+  return kwargs["num_threads"].cast<size_t>();
 }
 
 class SentencePieceLearnerWrapper : public SubwordLearnerWrapper
@@ -417,8 +469,10 @@ public:
     : SubwordLearnerWrapper(tokenizer,
                             std::make_unique<onmt::SentencePieceLearner>(false,
                                                                          parse_kwargs(kwargs),
-                                                                         create_temp_file(),
-                                                                         keep_vocab))
+                                                                         "",
+                                                                         keep_vocab,
+                                                                         false,
+                                                                         get_num_threads(kwargs)))
     , _keep_vocab(keep_vocab)
   {
   }
@@ -567,6 +621,28 @@ PYBIND11_MODULE(_ext, m)
            ));
     ;
 
+  py::class_<IdsMatrix>(m, "IdsMatrix", py::buffer_protocol())
+    .def_buffer([](IdsMatrix& matrix) {
+      return py::buffer_info(matrix.ids.data(),
+                             sizeof (int32_t),
+                             py::format_descriptor<int32_t>::format(),
+                             2,
+                             {matrix.rows, matrix.cols},
+                             {sizeof (int32_t) * matrix.cols, sizeof (int32_t)});
+    })
+    .def_readonly("rows", &IdsMatrix::rows)
+    .def_readonly("cols", &IdsMatrix::cols)
+    .def("tolist",
+         [](const IdsMatrix& matrix) {
+           std::vector<std::vector<int32_t>> rows;
+           rows.reserve(matrix.rows);
+           for (size_t i = 0; i < matrix.rows; ++i)
+             rows.emplace_back(matrix.ids.begin() + i * matrix.cols,
+                               matrix.ids.begin() + (i + 1) * matrix.cols);
+           return rows;
+         })
+    ;
+
   py::class_<TokenizerWrapper>(m, "Tokenizer")
     .def(py::init<
          const std::string&,
@@ -581,6 +657,7 @@ PYBIND11_MODULE(_ext, m)
          const std::optional<std::string>&,
          int,
          float,
+         size_t,
          const std::string&,
          bool,
          bool,
@@ -612,6 +689,7 @@ PYBIND11_MODULE(_ext, m)
          py::arg("sp_model_path")=py::none(),
          py::arg("sp_nbest_size")=0,
          py::arg("sp_alpha")=0.1,
+         py::arg("subword_cache_size")=0,
          py::arg("joiner")=onmt::Tokenizer::joiner_marker,
          py::arg("joiner_annotate")=false,
          py::arg("joiner_new")=false,
@@ -633,6 +711,7 @@ PYBIND11_MODULE(_ext, m)
     .def(py::init<const TokenizerWrapper&>(), py::arg("tokenizer"))
 
     .def_property_readonly("options", &TokenizerWrapper::get_options)
+    .def_property_readonly("subword_cache_stats", &TokenizerWrapper::get_subword_cache_stats)
 
     .def("__call__", &TokenizerWrapper::call,
          py::arg("text"),
@@ -647,6 +726,32 @@ PYBIND11_MODULE(_ext, m)
          py::arg("batch_text"),
          py::arg("as_token_objects")=false,
          py::arg("training")=true,
+         py::arg("num_threads")=1,
+         py::call_guard<py::gil_scoped_release>())
+
+    .def("tokenize_to_ids", &TokenizerWrapper::tokenize_to_ids<onmt::Vocab>,
+         py::arg("text"),
+         py::arg("vocab"),
+         py::arg("training")=true,
+         py::call_guard<py::gil_scoped_release>())
+    .def("tokenize_to_ids", &TokenizerWrapper::tokenize_to_ids<onmt::FrozenVocab>,
+         py::arg("text"),
+         py::arg("vocab"),
+         py::arg("training")=true,
+         py::call_guard<py::gil_scoped_release>())
+    .def("tokenize_batch_to_ids", &TokenizerWrapper::tokenize_batch_to_ids<onmt::Vocab>,
+         py::arg("batch_text"),
+         py::arg("vocab"),
+         py::arg("padding_id")=0,
+         py::arg("training")=true,
+         py::arg("num_threads")=1,
+         py::call_guard<py::gil_scoped_release>())
+    .def("tokenize_batch_to_ids", &TokenizerWrapper::tokenize_batch_to_ids<onmt::FrozenVocab>,
+         py::arg("batch_text"),
+         py::arg("vocab"),
+         py::arg("padding_id")=0,
+         py::arg("training")=true,
+         py::arg("num_threads")=1,
          py::call_guard<py::gil_scoped_release>())
 
     .def("detokenize",
@@ -682,6 +787,7 @@ PYBIND11_MODULE(_ext, m)
          py::arg("input_path"),
          py::arg("output_path"),
          py::arg("tokens_delimiter")=" ",
+         py::arg("num_threads")=1,
          py::call_guard<py::gil_scoped_release>())
 
     .def("serialize_tokens", &TokenizerWrapper::serialize_tokens,
@@ -726,11 +832,13 @@ PYBIND11_MODULE(_ext, m)
     ;
 
   py::class_<BPELearnerWrapper, SubwordLearnerWrapper>(m, "BPELearner")
-    .def(py::init<const std::optional<TokenizerWrapper>&, int, int, bool>(),
+    .def(py::init<const std::optional<TokenizerWrapper>&, int, int, bool, size_t, size_t>(),
          py::arg("tokenizer")=py::none(),
          py::arg("symbols")=10000,
          py::arg("min_frequency")=2,
-         py::arg("total_symbols")=false)
+         py::arg("total_symbols")=false,
+         py::arg("num_threads")=1,
+         py::arg("max_vocab_size")=0)
     ;
 
   py::class_<SentencePieceLearnerWrapper, SubwordLearnerWrapper>(m, "SentencePieceLearner")
@@ -780,14 +888,19 @@ PYBIND11_MODULE(_ext, m)
     .def("add_from_file",
          [](onmt::Vocab& vocab,
             const std::string& path,
-            const std::optional<TokenizerWrapper>& tokenizer) {
-           std::ifstream in(path);
-           if (!in)
-             throw std::invalid_argument("Failed to open input file " + path);
-           vocab.add_from_stream(in, tokenizer ? tokenizer.value().get().get() : nullptr);
+            const std::optional<TokenizerWrapper>& tokenizer,
+            size_t num_threads) {
+           vocab.add_from_files({path},
+                                tokenizer ? tokenizer.value().get().get() : nullptr,
+                                num_threads);
          },
          py::arg("path"),
          py::arg("tokenizer")=nullptr,
+         py::arg("num_threads")=1,
+         py::call_guard<py::gil_scoped_release>())
+
+    .def("merge", &onmt::Vocab::merge,
+         py::arg("other"),
          py::call_guard<py::gil_scoped_release>())
 
     .def("resize", &onmt::Vocab::resize,
@@ -795,6 +908,12 @@ PYBIND11_MODULE(_ext, m)
          py::arg("minimum_frequency")=1,
          py::call_guard<py::gil_scoped_release>())
 
+    .def("freeze",
+         [](const onmt::Vocab& vocab) {
+           return onmt::FrozenVocab(vocab);
+         },
+         py::call_guard<py::gil_scoped_release>())
+
     .def("__copy__",
          [](const onmt::Vocab& vocab) {
            return onmt::Vocab(vocab);
@@ -829,4 +948,28 @@ PYBIND11_MODULE(_ext, m)
              return vocab;
            }));
     ;
+
+  py::class_<onmt::FrozenVocab>(m, "FrozenVocab")
+    .def(py::init<const std::string&>(), py::arg("path"))
+    .def("save", &onmt::FrozenVocab::save, py::arg("path"))
+    .def("__len__", &onmt::FrozenVocab::size)
+    .def("__contains__", &onmt::FrozenVocab::contains, py::arg("token"))
+    .def("__getitem__", py::overload_cast<std::string_view>(&onmt::FrozenVocab::lookup, py::const_),
+         py::arg("token"))
+    .def("lookup_token", py::overload_cast<std::string_view>(&onmt::FrozenVocab::lookup, py::const_),
+         py::arg("token"))
+    .def("lookup_index", py::overload_cast<size_t>(&onmt::FrozenVocab::lookup, py::const_),
+         py::arg("index"))
+    .def("__call__",
+         [](const onmt::FrozenVocab& vocab, const std::vector<std::string>& tokens) {
+           std::vector<size_t> ids;
+           ids.reserve(tokens.size());
+           for (const auto& token : tokens)
+             ids.emplace_back(vocab.lookup(token));
+           return ids;
+         },
+         py::arg("tokens"),
+         py::call_guard<py::gil_scoped_release>())
+    .def_property_readonly("default_id", &onmt::FrozenVocab::get_default_id)
+    ;
 }
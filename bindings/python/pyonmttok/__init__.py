@@ -20,6 +20,8 @@ if sys.platform == "win32":
 from pyonmttok._ext import (
     BPELearner,
     Casing,
+    FrozenVocab,
+    IdsMatrix,
     SentencePieceLearner,
     SentencePieceTokenizer,
     SubwordLearner,
@@ -122,6 +122,22 @@ def test_file(tmpdir, tokens_delimiter):
         assert input_file.readline() == text + "\n"
 
 
+def test_detokenize_file_num_threads(tmpdir):
+    tokenizer = pyonmttok.Tokenizer("aggressive", joiner_annotate=True)
+    lines = ["Hello World %d!" % i for i in range(5000)]
+
+    input_path = str(tmpdir.join("input.txt"))
+    with open(input_path, "w", encoding="utf-8") as input_file:
+        for line in lines:
+            input_file.write(" ".join(tokenizer(line)))
+            input_file.write("\n")
+
+    output_path = str(tmpdir.join("output.txt"))
+    tokenizer.detokenize_file(input_path, output_path, num_threads=4)
+    with open(output_path, encoding="utf-8") as output_file:
+        assert output_file.read().splitlines() == lines
+
+
 def test_invalid_files(tmpdir):
     tokenizer = pyonmttok.Tokenizer("conservative")
     output_file = str(tmpdir.join("output.txt"))
@@ -228,6 +244,19 @@ def test_tokenize_batch():
     assert batch_features == [[["C", "L"]], [["U", "C"]]]
 
 
+def test_tokenize_batch_num_threads():
+    tokenizer = pyonmttok.Tokenizer("aggressive", joiner_annotate=True)
+    batch_text = ["Hello world!", "", "a" * 1000 + ".", "1,000"] * 50
+    expected = tokenizer.tokenize_batch(batch_text)
+    assert tokenizer.tokenize_batch(batch_text, num_threads=4) == expected
+
+    expected = tokenizer.tokenize_batch(batch_text, as_token_objects=True)
+    assert (
+        tokenizer.tokenize_batch(batch_text, as_token_objects=True, num_threads=4)
+        == expected
+    )
+
+
 @pytest.mark.parametrize("use_constructor", [False, True])
 def test_deepcopy(use_constructor):
     text = "Hello World!"
@@ -299,6 +328,46 @@ def test_subword_regularization():
     ]
 
 
+def test_subword_cache():
+    bpe_model_path = os.path.join(_DATA_DIR, "bpe-models", "testcode.v0.1")
+    text = "improvement improvement Improvement"
+    tokenizer = pyonmttok.Tokenizer("conservative", bpe_model_path=bpe_model_path)
+    cached_tokenizer = pyonmttok.Tokenizer(
+        "conservative", bpe_model_path=bpe_model_path, subword_cache_size=10
+    )
+    for _ in range(2):
+        assert cached_tokenizer.tokenize(text) == tokenizer.tokenize(text)
+
+
+def test_subword_cache_stats():
+    bpe_model_path = os.path.join(_DATA_DIR, "bpe-models", "testcode.v0.1")
+    text = "improvement improvement Improvement"
+    tokenizer = pyonmttok.Tokenizer("conservative", bpe_model_path=bpe_model_path)
+    cached_tokenizer = pyonmttok.Tokenizer(
+        "conservative", bpe_model_path=bpe_model_path, subword_cache_size=10
+    )
+    assert cached_tokenizer.subword_cache_stats == {"hits": 0, "misses": 0}
+
+    cached_tokenizer.tokenize(text)
+    stats = cached_tokenizer.subword_cache_stats
+    assert stats["misses"] > 0
+    num_lookups = stats["hits"] + stats["misses"]
+
+    # All words are in the cache for the second tokenization.
+    cached_tokenizer.tokenize(text)
+    assert cached_tokenizer.subword_cache_stats == {
+        "hits": stats["hits"] + num_lookups,
+        "misses": stats["misses"],
+    }
+
+    tokenizer.tokenize(text)
+    assert tokenizer.subword_cache_stats == {"hits": 0, "misses": 0}
+    assert pyonmttok.Tokenizer("conservative").subword_cache_stats == {
+        "hits": 0,
+        "misses": 0,
+    }
+
+
 def test_bpe_case_insensitive_issue_147():
     tokenizer = pyonmttok.Tokenizer(
         "conservative",
@@ -320,6 +389,36 @@ def test_bpe_learner(tmpdir):
     assert tokens == ["h￭", "ell￭", "o"]
 
 
+def test_bpe_learner_num_threads(tmpdir):
+    text = "The quick brown fox jumps over the lazy dog. " * 3
+    models = []
+    for num_threads in (1, 4):
+        learner = pyonmttok.BPELearner(symbols=20, min_frequency=1, num_threads=num_threads)
+        learner.ingest(text)
+        model_path = str(tmpdir.join("bpe-%d.model" % num_threads))
+        learner.learn(model_path)
+        with open(model_path, encoding="utf-8") as model:
+            models.append(model.read())
+    assert models[0] == models[1]
+
+
+def test_bpe_learner_ingest_file_num_threads(tmpdir):
+    input_path = str(tmpdir.join("input.txt"))
+    with open(input_path, "w", encoding="utf-8") as input_file:
+        for i in range(5000):
+            input_file.write("The quick brown fox %d jumps over the lazy dog.\n" % i)
+
+    models = []
+    for num_threads in (1, 4):
+        learner = pyonmttok.BPELearner(symbols=50, num_threads=num_threads)
+        learner.ingest_file(input_path)
+        model_path = str(tmpdir.join("bpe-%d.model" % num_threads))
+        learner.learn(model_path)
+        with open(model_path, encoding="utf-8") as model:
+            models.append(model.read())
+    assert models[0] == models[1]
+
+
 def test_bpe_learner_tokens(tmpdir):
     tokenizer = pyonmttok.Tokenizer("aggressive", joiner_annotate=True)
     learner = pyonmttok.BPELearner(tokenizer=tokenizer, symbols=2, min_frequency=1)
@@ -371,6 +470,21 @@ def test_sp_learner(tmpdir, keep_vocab):
     assert tokens == ["▁h", "e", "l", "l", "o"]
 
 
+def test_sp_learner_ingest_file_num_threads(tmpdir):
+    input_path = str(tmpdir.join("input.txt"))
+    with open(input_path, "w", encoding="utf-8") as input_file:
+        for _ in range(100):
+            input_file.write("hello word! how are you?\n")
+
+    learner = pyonmttok.SentencePieceLearner(
+        vocab_size=17, character_coverage=0.98, num_threads=2
+    )
+    learner.ingest_file(input_path)
+    tokenizer = learner.learn(str(tmpdir.join("sp")))
+    tokens, _ = tokenizer.tokenize("hello")
+    assert tokens == ["▁h", "e", "l", "l", "o"]
+
+
 @pytest.mark.parametrize(
     "learner",
     [
@@ -642,6 +756,30 @@ def test_vocab_from_file(tmpdir):
     assert vocab.ids_to_tokens == ["Hello", "World", "￭!"]
 
 
+def test_vocab_from_file_num_threads(tmpdir):
+    input_path = str(tmpdir.join("input.txt"))
+    with open(input_path, "w", encoding="utf-8") as input_file:
+        for i in range(20000):
+            input_file.write("Hello World %d!\n" % (i % 300))
+
+    tokenizer = pyonmttok.Tokenizer("aggressive", joiner_annotate=True)
+    vocabs = []
+    for num_threads in (1, 4):
+        vocab = pyonmttok.Vocab(special_tokens=["<unk>"])
+        vocab.add_from_file(input_path, tokenizer, num_threads=num_threads)
+        vocabs.append(vocab)
+    assert vocabs[0].ids_to_tokens == vocabs[1].ids_to_tokens
+    assert vocabs[0].counters == vocabs[1].counters
+
+
+def test_vocab_merge():
+    vocab = pyonmttok.build_vocab_from_tokens(["a", "b", "a"], special_tokens=["<unk>"])
+    other = pyonmttok.build_vocab_from_tokens(["c", "b"], special_tokens=["<s>"])
+    vocab.merge(other)
+    assert vocab.ids_to_tokens == ["<unk>", "a", "b", "<s>", "c"]
+    assert vocab.counters == [_MAX_COUNTER, 2, 2, _MAX_COUNTER, 1]
+
+
 def test_vocab_build_helpers():
     tokenizer = pyonmttok.Tokenizer("aggressive", joiner_annotate=True)
     lines = ["Hello World!", "Hello all."]
@@ -685,3 +823,44 @@ def test_vocab_pickle():
     assert vocab_clone.ids_to_tokens == ["z", "a", "b", "c"]
     assert vocab_clone.default_id == 0
     assert vocab_clone.counters == [_MAX_COUNTER, 3, 1, 2]
+
+
+def test_frozen_vocab(tmpdir):
+    vocab = pyonmttok.build_vocab_from_tokens(
+        ["a", "b", "a", "a", "c", "c"], special_tokens=["<unk>"]
+    )
+    frozen_vocab = vocab.freeze()
+    assert len(frozen_vocab) == 4
+    assert frozen_vocab.default_id == 0
+    assert "a" in frozen_vocab
+    assert "d" not in frozen_vocab
+    assert frozen_vocab["c"] == 3
+    assert frozen_vocab.lookup_index(2) == "b"
+    assert frozen_vocab(["a", "b", "d"]) == vocab(["a", "b", "d"])
+
+    path = str(tmpdir.join("vocab.bin"))
+    frozen_vocab.save(path)
+    loaded_vocab = pyonmttok.FrozenVocab(path)
+    assert len(loaded_vocab) == 4
+    assert loaded_vocab(["a", "b", "c", "d"]) == [1, 2, 3, 0]
+
+
+@pytest.mark.parametrize("freeze", [False, True])
+def test_tokenize_to_ids(freeze):
+    tokenizer = pyonmttok.Tokenizer("aggressive", joiner_annotate=True)
+    vocab = pyonmttok.build_vocab_from_tokens(
+        ["Hello", "World", "￭!"], special_tokens=["<blank>", "<unk>"]
+    )
+    if freeze:
+        vocab = vocab.freeze()
+
+    assert tokenizer.tokenize_to_ids("Hello World!", vocab) == [2, 3, 4]
+    assert tokenizer.tokenize_to_ids("Hello you!", vocab) == [2, 1, 4]
+
+    ids, lengths = tokenizer.tokenize_batch_to_ids(
+        ["Hello World!", "", "you"], vocab, num_threads=2
+    )
+    assert (ids.rows, ids.cols) == (3, 3)
+    assert ids.tolist() == [[2, 3, 4], [0, 0, 0], [1, 0, 0]]
+    assert lengths == [3, 0, 1]
+    assert memoryview(ids).shape == (3, 3)
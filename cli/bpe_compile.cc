@@ -0,0 +1,37 @@
+#include <iostream>
+
+#include <cxxopts.hpp>
+
+#include <onmt/BPE.h>
+
+int main(int argc, char* argv[])
+{
+  cxxopts::Options cmd_options("bpe_compile",
+                               "Convert a BPE model to the compiled binary format.\n\n"
+                               "bpe_compile --input bpe.codes --output bpe.compiled\n");
+  cmd_options.add_options()
+    ("h,help", "Show this help")
+    ("i,input", "Path to the BPE model",
+     cxxopts::value<std::string>())
+    ("o,output", "Path to the compiled BPE model",
+     cxxopts::value<std::string>())
+    ;
+
+  auto vm = cmd_options.parse(argc, argv);
+
+  if (vm.count("help"))
+  {
+    std::cout << cmd_options.help() << std::endl;
+    return 0;
+  }
+
+  if (!vm.count("input") || !vm.count("output"))
+  {
+    std::cerr << "The options --input and --output are required" << std::endl;
+    return 1;
+  }
+
+  const onmt::BPE bpe(vm["input"].as<std::string>());
+  bpe.save_compiled_model(vm["output"].as<std::string>());
+  return 0;
+}
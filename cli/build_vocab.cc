@@ -0,0 +1,101 @@
+#include <fstream>
+#include <iostream>
+
+#include <cxxopts.hpp>
+
+#include <onmt/Tokenizer.h>
+#include <onmt/Vocab.h>
+
+#include "tokenization_args.h"
+
+int main(int argc, char* argv[])
+{
+  cxxopts::Options cmd_options("build_vocab",
+                               "Build a vocabulary from tokenized files.\n\n"
+                               "build_vocab [TOKENIZATION_OPTIONS...] -i train.txt -o vocab.txt\n");
+  cmd_options.add_options()
+    ("h,help", "Show this help")
+    ("i,input", "Input files (if not set, the standard input is used)",
+     cxxopts::value<std::vector<std::string>>())
+    ("o,output", "Output file with one token per line (if not set, the standard output is used)",
+     cxxopts::value<std::string>())
+    ("size", "Maximum vocabulary size (0 for no limit)",
+     cxxopts::value<size_t>()->default_value("0"))
+    ("min_frequency", "Minimum frequency of the tokens",
+     cxxopts::value<size_t>()->default_value("1"))
+    ("special_tokens", "Comma-separated list of tokens added first and never removed",
+     cxxopts::value<std::vector<std::string>>()->default_value(""))
+    ("num_threads", "Number of threads used to tokenize the input",
+     cxxopts::value<size_t>()->default_value("1"))
+    ("frozen", "Save the vocabulary in the binary format of FrozenVocab (requires --output)",
+     cxxopts::value<bool>()->default_value("false"))
+    ;
+
+  add_tokenization_options(cmd_options);
+
+  auto vm = cmd_options.parse(argc, argv);
+
+  if (vm.count("help"))
+  {
+    std::cout << cmd_options.help() << std::endl;
+    return 0;
+  }
+
+  const bool frozen = vm["frozen"].as<bool>();
+  if (frozen && !vm.count("output"))
+  {
+    std::cerr << "The option --frozen requires --output" << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> special_tokens;
+  for (const auto& token : vm["special_tokens"].as<std::vector<std::string>>())
+  {
+    if (!token.empty())
+      special_tokens.emplace_back(token);
+  }
+
+  const onmt::Tokenizer tokenizer(build_tokenization_options(vm));
+  const size_t num_threads = vm["num_threads"].as<size_t>();
+
+  onmt::Vocab vocab(special_tokens);
+  try
+  {
+    if (vm.count("input"))
+      vocab.add_from_files(vm["input"].as<std::vector<std::string>>(), &tokenizer, num_threads);
+    else
+      vocab.add_from_stream(std::cin, &tokenizer, num_threads);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << "ERROR: " << e.what() << std::endl;
+    return 1;
+  }
+
+  vocab.resize(vm["size"].as<size_t>(), vm["min_frequency"].as<size_t>());
+
+  if (frozen)
+  {
+    const onmt::FrozenVocab frozen_vocab(vocab);
+    frozen_vocab.save(vm["output"].as<std::string>());
+    return 0;
+  }
+
+  std::ostream* out = &std::cout;
+  std::ofstream output_file;
+  if (vm.count("output"))
+  {
+    const std::string output_path = vm["output"].as<std::string>();
+    output_file.open(output_path);
+    if (!output_file)
+    {
+      std::cerr << "ERROR: cannot open file " << output_path << " for writing" << std::endl;
+      return 1;
+    }
+    out = &output_file;
+  }
+
+  for (const auto& token : vocab.ids_to_tokens())
+    *out << token << '\n';
+  return 0;
+}
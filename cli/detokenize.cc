@@ -6,6 +6,10 @@
 
 int main(int argc, char* argv[])
 {
+  // Unsynchronized streams can report the available input, so lines are processed as
+  // soon as they are entered.
+  std::ios::sync_with_stdio(false);
+
   cxxopts::Options cmd_options("detokenize");
   cmd_options.add_options()
     ("h,help", "Show this help")
@@ -21,6 +25,8 @@ int main(int argc, char* argv[])
      cxxopts::value<bool>()->default_value("false"))
     ("tokens_delimiter", "String delimiting the tokens",
      cxxopts::value<std::string>()->default_value(" "))
+    ("num_threads", "Number of threads to use",
+     cxxopts::value<int>()->default_value("1"))
     ;
 
   auto vm = cmd_options.parse(argc, argv);
@@ -39,6 +45,9 @@ int main(int argc, char* argv[])
   options.with_separators = vm["with_separators"].as<bool>();
   onmt::Tokenizer tokenizer(std::move(options));
 
-  tokenizer.detokenize_stream(std::cin, std::cout, vm["tokens_delimiter"].as<std::string>());
+  tokenizer.detokenize_stream(std::cin,
+                              std::cout,
+                              vm["tokens_delimiter"].as<std::string>(),
+                              vm["num_threads"].as<int>());
   return 0;
 }
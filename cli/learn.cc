@@ -29,8 +29,6 @@ int main(int argc, char* argv[])
      cxxopts::value<std::vector<std::string>>())
     ("o,output", "Output file (if not set, the standard output is used)",
      cxxopts::value<std::string>())
-    ("tmpfile", "Temporary file for file-based learner",
-     cxxopts::value<std::string>()->default_value("input.tmp"))
     ("subword", "Arguments for subword learner",
      cxxopts::value<std::vector<std::string>>());
 
@@ -67,6 +65,12 @@ int main(int argc, char* argv[])
        "(so that '--symbols' becomes an estimate for the total number of "
        "symbols needed to encode text)",
        cxxopts::value<bool>()->default_value("false"))
+      ("num-threads", "Number of threads used to ingest the input and compute the pair statistics",
+       cxxopts::value<size_t>()->default_value("1"))
+      ("max-vocab-size",
+       "If set, remove the least frequent words when more words were ingested "
+       "(the memory usage is bounded but the word counts are approximate)",
+       cxxopts::value<size_t>()->default_value("0"))
       ;
 
     // Parse BPE options only.
@@ -87,15 +91,15 @@ int main(int argc, char* argv[])
                                    subvm["symbols"].as<int>(),
                                    subvm["min-frequency"].as<int>(),
                                    subvm["dict-input"].as<bool>(),
-                                   subvm["total-symbols"].as<bool>());
+                                   subvm["total-symbols"].as<bool>(),
+                                   subvm["num-threads"].as<size_t>(),
+                                   subvm["max-vocab-size"].as<size_t>());
 
   }
   else if (subword == "sentencepiece") {
     learner = new onmt::SentencePieceLearner(vm["verbose"].as<bool>(),
                                              std::vector<std::string>(subword_args.begin() + 1,
-                                                                      subword_args.end()),
-                                             vm["tmpfile"].as<std::string>());
-    return 1;
+                                                                      subword_args.end()));
   }
   else {
     std::cerr << "ERROR: invalid subword type: " << subword << " (accepted: bpe, sentencepiece)" << std::endl;
@@ -1,3 +1,4 @@
+#include <fstream>
 #include <iostream>
 
 #include <cxxopts.hpp>
@@ -10,6 +11,10 @@
 
 int main(int argc, char* argv[])
 {
+  // Unsynchronized streams can report the available input, so lines are processed as
+  // soon as they are entered.
+  std::ios::sync_with_stdio(false);
+
   cxxopts::Options cmd_options("tokenize");
   cmd_options.add_options()
     ("h,help", "Show this help")
@@ -21,6 +26,10 @@ int main(int argc, char* argv[])
      cxxopts::value<bool>()->default_value("false"))
     ("tokens_delimiter", "String delimiting the tokens",
      cxxopts::value<std::string>()->default_value(" "))
+    ("i,input", "Input file, read with a memory mapping (if not set, the standard input is used)",
+     cxxopts::value<std::string>())
+    ("o,output", "Output file (if not set, the standard output is used)",
+     cxxopts::value<std::string>())
     ;
 
   add_tokenization_options(cmd_options);
@@ -51,6 +60,8 @@ int main(int argc, char* argv[])
     ("vocabulary_threshold",
      "If vocabulary is provided, any word with frequency < threshold will be treated as OOV.",
      cxxopts::value<int>()->default_value("0"))
+    ("subword_cache_size", "Cache the subword encoding of up to this many words",
+     cxxopts::value<size_t>()->default_value("0"))
     ;
 
   auto vm = cmd_options.parse(argc, argv);
@@ -94,15 +105,49 @@ int main(int argc, char* argv[])
   auto options = build_tokenization_options(vm);
   if (subword_encoder && !vocabulary.empty())
     subword_encoder->load_vocabulary(vocabulary, vocabulary_threshold, &options);
+  if (subword_encoder)
+    subword_encoder->set_cache_size(vm["subword_cache_size"].as<size_t>());
 
   onmt::Tokenizer tokenizer(std::move(options),
                             std::shared_ptr<onmt::SubwordEncoder>(subword_encoder));
 
-  tokenizer.tokenize_stream(std::cin,
-                            std::cout,
-                            vm["num_threads"].as<int>(),
-                            vm["verbose"].as<bool>(),
+  if (vm.count("input") && !std::ifstream(vm["input"].as<std::string>()))
+  {
+    std::cerr << "ERROR: cannot open file " << vm["input"].as<std::string>() << " for reading" << std::endl;
+    return 1;
+  }
+
+  std::ostream* out = &std::cout;
+  std::ofstream output_file;
+  if (vm.count("output"))
+  {
+    const std::string output_path = vm["output"].as<std::string>();
+    output_file.open(output_path);
+    if (!output_file)
+    {
+      std::cerr << "ERROR: cannot open file " << output_path << " for writing" << std::endl;
+      return 1;
+    }
+    out = &output_file;
+  }
+
+  const size_t num_threads = vm["num_threads"].as<int>();
+  const bool verbose = vm["verbose"].as<bool>();
+  const std::string tokens_delimiter = vm["tokens_delimiter"].as<std::string>();
+
+  if (vm.count("input"))
+    tokenizer.tokenize_file(vm["input"].as<std::string>(),
+                            *out,
+                            num_threads,
+                            verbose,
                             /*training=*/true,
-                            vm["tokens_delimiter"].as<std::string>());
+                            tokens_delimiter);
+  else
+    tokenizer.tokenize_stream(std::cin,
+                              *out,
+                              num_threads,
+                              verbose,
+                              /*training=*/true,
+                              tokens_delimiter);
   return 0;
 }
@@ -1,7 +1,7 @@
 #pragma once
 
+#include <memory>
 #include <string>
-#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 
@@ -35,9 +35,16 @@ namespace onmt
       _dropout = dropout;
     }
 
+    // Saves the model in a binary format that is loaded without parsing. BPE models
+    // saved in this format can be passed to the constructors like text models.
+    void save_compiled_model(const std::string& path) const;
+
     static std::vector<std::string> get_initial_pieces(const std::vector<unicode::CharInfo>& chars,
                                                        const bool lowercase = false);
 
+  protected:
+    bool is_sampling(bool training) const override;
+
   private:
     std::string _end_of_word;
     std::string _begin_of_word;
@@ -50,14 +57,25 @@ namespace onmt
     // Tokenization options used to produce the vocabulary passed to set_vocabulary.
     Tokenizer::Options _tokenization_options;
 
-    std::unordered_map<std::string, int> _codes;
-    std::unordered_map<std::string, std::pair<std::string, std::string> > _codes_reverse;
+    // Symbols (initial characters and merged pieces) are interned into integer IDs.
+    // Merges are stored in an open addressing table keyed on the pair of symbol IDs.
+    // These tables are saved in a compiled model that can be memory mapped.
+    class CompiledModel;
+    std::shared_ptr<const CompiledModel> _model;
     std::unordered_set<std::string> _bpe_vocab;
 
     void load_model(const std::string& model_path);
+    void load_text_model(const std::string& model_path);
+
+    std::pair<int, int> get_merge(int left,
+                                  int right,
+                                  const std::vector<std::string>& pieces) const;
 
-    int get_score(const std::string& gram1, const std::string& gram2) const;
-    void apply_merges(std::vector<std::string>& chars, bool training) const;
+    void apply_merges(std::vector<std::string>& pieces, bool training) const;
+    void apply_merges_with_queue(std::vector<int>& symbols,
+                                 const std::vector<std::string>& pieces) const;
+    void apply_merges_with_dropout(std::vector<int>& symbols,
+                                   const std::vector<std::string>& pieces) const;
 
     bool in_vocabulary(const std::string& token) const;
     bool in_vocabulary(const onmt::Token& token, const bool first, const bool last) const;
@@ -10,18 +10,32 @@ namespace onmt
   class OPENNMTTOKENIZER_EXPORT BPELearner: public SubwordLearner
   {
   public:
+    // The ingested text is tokenized and counted, and the pair statistics are computed
+    // with num_threads threads. The learned merges do not depend on the number of threads.
+    //
+    // If max_vocab_size > 0, the least frequent words are removed when more than
+    // max_vocab_size different words were ingested. This bounds the memory usage but
+    // the counts become approximate. Lines read from streams are counted by batches and
+    // the vocabulary is only reduced after each batch.
     BPELearner(bool verbose,
-               int symbols, int min_frequency, bool dict_input, bool total_symbols);
+               int symbols, int min_frequency, bool dict_input, bool total_symbols,
+               size_t num_threads = 1,
+               size_t max_vocab_size = 0);
+    using SubwordLearner::ingest;
     void ingest(std::istream& is, const Tokenizer* tokenizer = nullptr) override;
     void learn(std::ostream& os, const char* description = 0, bool verbose = false) override;
   protected:
     void ingest_token_impl(const std::string& token) final;
+    void ingest_batch(const std::vector<std::string>& lines, const Tokenizer& tokenizer) override;
   private:
     void load_from_dictionary(std::istream& is);
+    void add_word(const std::string& word, int count);
+    void maybe_reduce_vocab();
     int _symbols;
     int _min_frequency;
     bool _dict_input;
     bool _total_symbols;
+    size_t _max_vocab_size;
     std::unordered_map<std::string, int> _vocab;
   };
 
@@ -34,6 +34,14 @@ namespace onmt
                           std::vector<std::string>& words,
                           bool training = true) const;
 
+    // Tokenizes text and appends the tokens to output in the format of write_tokens. The
+    // default implementation builds the tokens and features vectors, tokenizers can override
+    // it to serialize the tokens directly. This is the function used by tokenize_stream.
+    virtual void tokenize_and_write(const std::string& text,
+                                    std::string& output,
+                                    const std::string& tokens_delimiter = " ",
+                                    bool training = true) const;
+
     virtual std::string detokenize(const std::vector<std::string>& words,
                                    const std::vector<std::vector<std::string> >& features) const = 0;
     virtual std::string detokenize(const std::vector<std::string>& words) const;
@@ -51,9 +59,36 @@ namespace onmt
                          const std::string& tokens_delimiter = " ",
                          size_t buffer_size = 1000) const;
 
+    // Same as tokenize_stream but the input file is memory mapped instead of read in a
+    // stream buffer (except when the file can not be mapped, e.g. a named pipe).
+    void tokenize_file(const std::string& input_path,
+                       std::ostream& os,
+                       size_t num_threads = 1,
+                       bool verbose = false,
+                       bool training = true,
+                       const std::string& tokens_delimiter = " ",
+                       size_t buffer_size = 1000) const;
+    void tokenize_file(const std::string& input_path,
+                       const std::string& output_path,
+                       size_t num_threads = 1,
+                       bool verbose = false,
+                       bool training = true,
+                       const std::string& tokens_delimiter = " ",
+                       size_t buffer_size = 1000) const;
+
+    // Lines are detokenized with up to num_threads threads, in batches of buffer_size lines,
+    // and written in order.
     void detokenize_stream(std::istream& is,
                            std::ostream& os,
-                           const std::string& tokens_delimiter = " ") const;
+                           const std::string& tokens_delimiter = " ",
+                           size_t num_threads = 1,
+                           size_t buffer_size = 1000) const;
+    // Same as detokenize_stream but the input file is memory mapped when possible.
+    void detokenize_file(const std::string& input_path,
+                         const std::string& output_path,
+                         const std::string& tokens_delimiter = " ",
+                         size_t num_threads = 1,
+                         size_t buffer_size = 1000) const;
   };
 
   void read_tokens(const std::string& line,
@@ -30,6 +30,9 @@ namespace onmt
     std::vector<std::string> encode(const std::string& str, bool training = true) const override;
     std::vector<Token> encode_and_annotate(const Token& token, bool training = true) const override;
 
+  protected:
+    bool is_sampling(bool training) const override;
+
   private:
     const std::unique_ptr<sentencepiece::SentencePieceProcessor> _processor;
     int _nbest_size;
@@ -1,8 +1,8 @@
 #pragma once
 
-#include <fstream>
-#include <memory>
+#include <cstdint>
 #include <unordered_map>
+#include <vector>
 
 #include "onmt/opennmttokenizer_export.h"
 #include "onmt/SubwordLearner.h"
@@ -15,21 +15,28 @@ namespace onmt
   public:
     SentencePieceLearner(bool verbose,
                          const std::string& opts,
-                         const std::string& input_filename,
-                         bool keep_vocab = false, 
-                         bool keep_input_file = false);
+                         const std::string& input_filename = "",
+                         bool keep_vocab = false,
+                         bool keep_input_file = false,
+                         size_t num_threads = 1);
     SentencePieceLearner(bool verbose,
                          const std::vector<std::string>& opts,
-                         const std::string& input_filename,
-                         bool keep_vocab = false, 
-                         bool keep_input_file = false);
+                         const std::string& input_filename = "",
+                         bool keep_vocab = false,
+                         bool keep_input_file = false,
+                         size_t num_threads = 1);
     SentencePieceLearner(bool verbose,
                          const std::unordered_map<std::string, std::string>& opts,
-                         const std::string& input_filename,
-                         bool keep_vocab = false, 
-                         bool keep_input_file = false);
-    ~SentencePieceLearner();
-
+                         const std::string& input_filename = "",
+                         bool keep_vocab = false,
+                         bool keep_input_file = false,
+                         size_t num_threads = 1);
+    // The ingested sentences are kept in memory and saved to input_filename when
+    // keep_input_file is set. With model_type bpe, char, or word, the sentences are
+    // deduplicated and passed to the trainer once with their frequency (and saved in the
+    // "sentence<tab>count" format). Tabs in the sentences are then replaced by spaces. The
+    // unigram model would change if its input was deduplicated, so it receives the
+    // sentences as ingested.
     void set_input_filename(const std::string& filename);
 
     void learn(std::ostream& os, const char* description = 0, bool verbose = false) override;
@@ -38,12 +45,21 @@ namespace onmt
                bool verbose = false) override;
   protected:
     void ingest_token_impl(const std::string& token) final;
+    void ingest_batch(const std::vector<std::string>& lines, const Tokenizer& tokenizer) override;
   private:
+    using SentenceCounts = std::unordered_map<std::string, int64_t>;
+
     std::string _args;
     std::string _input_filename;
     bool _keep_vocab;
-    std::unique_ptr<std::ofstream> _input_stream;
     bool _keep_input_file;
+    bool _deduplicate;
+    std::vector<std::string> _raw_sentences;  // When the sentences are not deduplicated.
+    SentenceCounts _sentence_counts;
+    std::vector<const SentenceCounts::value_type*> _sentences;  // In ingestion order.
+
+    void add_sentence(const std::string& sentence, int64_t count);
+    void train(const std::string& args, std::string* serialized_model, bool verbose);
   };
 
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -12,7 +13,14 @@ namespace onmt
   class OPENNMTTOKENIZER_EXPORT SubwordEncoder
   {
   public:
-    virtual ~SubwordEncoder() = default;
+    struct CacheStats
+    {
+      size_t hits = 0;
+      size_t misses = 0;
+    };
+
+    SubwordEncoder();
+    virtual ~SubwordEncoder();
 
     // Maybe update the tokenization options for this subword encoder.
     virtual void update_tokenization_options(Tokenizer::Options& options) const;
@@ -31,7 +39,25 @@ namespace onmt
     virtual std::vector<Token> encode_and_annotate(const std::vector<Token>& tokens,
                                                    bool training = true) const;
 
+    // Enables a cache of the encoded words with at most cache_size entries (0 disables
+    // the cache). This should be called before encoding. The cache is safe to use from
+    // multiple threads and is bypassed when the encoding is sampled (e.g. BPE dropout).
+    void set_cache_size(size_t cache_size);
+    size_t get_cache_size() const;
+    CacheStats get_cache_stats() const;
+
     static void propagate_token_properties(const Token& token, std::vector<Token>& tokens);
+
+  protected:
+    // Returns true if encoding the same string can return different results.
+    virtual bool is_sampling(bool training) const;
+
+    std::vector<std::string> encode_with_cache(const std::string& str, bool training) const;
+    void clear_cache();
+
+  private:
+    class Cache;
+    std::shared_ptr<Cache> _cache;
   };
 
 }
@@ -2,6 +2,7 @@
 
 #include <memory>
 #include <string>
+#include <vector>
 #include <iostream>
 
 #include "onmt/opennmttokenizer_export.h"
@@ -13,12 +14,17 @@ namespace onmt
   class OPENNMTTOKENIZER_EXPORT SubwordLearner
   {
   public:
-    SubwordLearner(bool verbose, const Tokenizer* default_tokenizer = nullptr);
+    // Streams are tokenized with num_threads threads.
+    SubwordLearner(bool verbose,
+                   const Tokenizer* default_tokenizer = nullptr,
+                   size_t num_threads = 1);
     virtual ~SubwordLearner() = default;
     virtual void ingest_token(const Token& token);
     virtual void ingest_token(const std::string& token, const Tokenizer* tokenizer = nullptr);
     virtual void ingest(const std::string& text, const Tokenizer* tokenizer = nullptr);
     virtual void ingest(std::istream& in, const Tokenizer* tokenizer = nullptr);
+    // Ingests a batch of lines, which are tokenized with num_threads threads.
+    void ingest(const std::vector<std::string>& lines, const Tokenizer* tokenizer = nullptr);
     virtual void learn(std::ostream& out, const char* description = nullptr, bool verbose = false) = 0;
     virtual void learn(const std::string& model_path,
                        const char* description = nullptr,
@@ -27,8 +33,13 @@ namespace onmt
     const std::shared_ptr<const Tokenizer>& get_default_tokenizer() const;
   protected:
     virtual void ingest_token_impl(const std::string& token) = 0;
+    // Ingests a batch of lines read from a stream. The default implementation tokenizes the
+    // lines in parallel and ingests the tokens in order.
+    virtual void ingest_batch(const std::vector<std::string>& lines, const Tokenizer& tokenizer);
+    static bool should_ingest(const Token& token);
     bool _verbose;
     std::shared_ptr<const Tokenizer> _default_tokenizer;
+    size_t _num_threads;
   };
 
 }
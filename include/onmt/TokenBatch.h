@@ -0,0 +1,114 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "onmt/opennmttokenizer_export.h"
+#include "onmt/Token.h"
+
+namespace onmt
+{
+
+  // Token referencing its surface and features instead of owning them.
+  class OPENNMTTOKENIZER_EXPORT TokenSpan
+  {
+  public:
+    std::string_view surface;
+    TokenType type = TokenType::Word;
+    Casing casing = Casing::None;
+    bool join_left = false;
+    bool join_right = false;
+    bool spacer = false;
+    bool preserve = false;
+    size_t features_offset = 0;  // Index of the first feature in TokenBatch::features().
+    size_t num_features = 0;
+
+    bool empty() const
+    {
+      return surface.empty();
+    }
+
+    bool is_placeholder() const;
+  };
+
+  // Tokenization output where the surfaces and features are views on the tokenized text,
+  // so that unmodified tokens are not copied. Surfaces that are not in the text
+  // (e.g. substituted characters) are stored in the batch.
+  //
+  // The tokenized text should outlive the batch. The batch can be reused to avoid
+  // allocating its storage on each tokenization.
+  class OPENNMTTOKENIZER_EXPORT TokenBatch
+  {
+  public:
+    TokenBatch();
+    ~TokenBatch();
+    TokenBatch(TokenBatch&&) noexcept;
+    TokenBatch& operator=(TokenBatch&&) noexcept;
+
+    // Copies would reference the storage of the original batch.
+    TokenBatch(const TokenBatch&) = delete;
+    TokenBatch& operator=(const TokenBatch&) = delete;
+
+    size_t size() const
+    {
+      return _tokens.size();
+    }
+
+    bool empty() const
+    {
+      return _tokens.empty();
+    }
+
+    const TokenSpan& operator[](size_t index) const
+    {
+      return _tokens[index];
+    }
+
+    std::vector<TokenSpan>::const_iterator begin() const
+    {
+      return _tokens.begin();
+    }
+
+    std::vector<TokenSpan>::const_iterator end() const
+    {
+      return _tokens.end();
+    }
+
+    const std::vector<std::string_view>& features() const
+    {
+      return _features;
+    }
+
+    std::string_view get_feature(const TokenSpan& token, size_t index) const
+    {
+      return _features[token.features_offset + index];
+    }
+
+    // Removes all tokens but keeps the allocated memory.
+    void clear();
+
+    // Replaces the content of the batch by a copy of these tokens.
+    void assign(const std::vector<Token>& tokens);
+
+    // Appends owning copies of the tokens.
+    void to_tokens(std::vector<Token>& tokens) const;
+    std::vector<Token> to_tokens() const;
+
+  private:
+    class Storage;
+
+    std::vector<TokenSpan> _tokens;
+    std::vector<std::string_view> _features;
+    std::unique_ptr<Storage> _storage;
+
+    // Returns the address of a contiguous region of size + extra_size bytes that starts
+    // with the size bytes at data (if any). The region is not moved when possible.
+    char* extend_storage(const char* data, size_t size, size_t extra_size);
+    std::string_view copy_to_storage(std::string_view str);
+
+    friend class TokensBuilder;
+  };
+
+}
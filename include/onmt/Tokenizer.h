@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <unordered_map>
 #include <unordered_set>
@@ -7,6 +8,8 @@
 #include "onmt/opennmttokenizer_export.h"
 #include "onmt/ITokenizer.h"
 #include "onmt/Token.h"
+#include "onmt/TokenBatch.h"
+#include "onmt/unicode/Unicode.h"
 
 namespace onmt
 {
@@ -14,6 +17,23 @@ namespace onmt
   void OPENNMTTOKENIZER_EXPORT set_random_seed(const unsigned int seed);
 
   class SubwordEncoder;
+  class Vocab;
+  class FrozenVocab;
+
+  // Buffers that are reused across tokenizations to avoid memory allocations.
+  // A workspace should not be used by multiple threads at the same time.
+  class OPENNMTTOKENIZER_EXPORT TokenizationWorkspace
+  {
+  private:
+    std::vector<unicode::CharInfo> _chars;
+    std::vector<int> _scripts;
+    TokenBatch _batch;
+    std::vector<Token> _tokens;
+    std::string _token_buffer;
+    std::string _lookup_key;
+
+    friend class Tokenizer;
+  };
 
   class OPENNMTTOKENIZER_EXPORT Tokenizer: public ITokenizer
   {
@@ -91,6 +111,67 @@ namespace onmt
     void tokenize(const std::string& text,
                   std::vector<Token>& annotated_tokens,
                   bool training = true) const;
+    // Tokenizes into token views on text. Without case_feature, case_markup, and subword
+    // encoder, unmodified tokens are not copied.
+    void tokenize(const std::string& text,
+                  TokenBatch& batch,
+                  bool training = true) const;
+
+    // The overloads without workspace use a workspace that is local to the calling thread.
+    void tokenize(const std::string& text,
+                  TokenBatch& batch,
+                  TokenizationWorkspace& workspace,
+                  bool training = true) const;
+    void tokenize(const std::string& text,
+                  std::vector<std::string>& words,
+                  std::vector<std::vector<std::string> >& features,
+                  TokenizationWorkspace& workspace,
+                  bool training = true) const;
+    void tokenize_and_write(const std::string& text,
+                            std::string& output,
+                            const std::string& tokens_delimiter = " ",
+                            bool training = true) const override;
+
+    // Tokenizes the texts with up to num_threads threads from a pool that is shared by
+    // all tokenizers. The results are in the same order as the texts.
+    void tokenize_batch(const std::vector<std::string>& texts,
+                        std::vector<std::vector<Token>>& tokens,
+                        size_t num_threads = 1,
+                        bool training = true) const;
+    void tokenize_batch(const std::vector<std::string>& texts,
+                        std::vector<std::vector<std::string>>& words,
+                        std::vector<std::vector<std::vector<std::string>>>& features,
+                        size_t num_threads = 1,
+                        bool training = true) const;
+
+    // Tokenizes and appends the vocabulary ID of each token, without building the token
+    // strings. Features are ignored.
+    void tokenize_to_ids(const std::string& text,
+                         const Vocab& vocab,
+                         std::vector<int32_t>& ids,
+                         bool training = true) const;
+    void tokenize_to_ids(const std::string& text,
+                         const FrozenVocab& vocab,
+                         std::vector<int32_t>& ids,
+                         bool training = true) const;
+
+    // Batch version of tokenize_to_ids. ids is a row-major matrix of texts.size() rows where
+    // each row is padded with padding_id to the maximum length. lengths contains the number
+    // of IDs in each row.
+    void tokenize_batch_to_ids(const std::vector<std::string>& texts,
+                               const Vocab& vocab,
+                               std::vector<int32_t>& ids,
+                               std::vector<size_t>& lengths,
+                               int32_t padding_id = 0,
+                               size_t num_threads = 1,
+                               bool training = true) const;
+    void tokenize_batch_to_ids(const std::vector<std::string>& texts,
+                               const FrozenVocab& vocab,
+                               std::vector<int32_t>& ids,
+                               std::vector<size_t>& lengths,
+                               int32_t padding_id = 0,
+                               size_t num_threads = 1,
+                               bool training = true) const;
 
     Token annotate_token(const std::string& word) const;
     void annotate_tokens(const std::vector<std::string>& words,
@@ -99,6 +180,11 @@ namespace onmt
     void finalize_tokens(const std::vector<Token>& annotated_tokens,
                          std::vector<std::string>& tokens,
                          std::vector<std::vector<std::string>>& features) const;
+    // Appends the final tokens to output in the format of write_tokens, without building
+    // the intermediate tokens and features vectors.
+    void finalize_tokens(const std::vector<Token>& annotated_tokens,
+                         std::string& output,
+                         const std::string& tokens_delimiter = " ") const;
     std::string detokenize(const std::vector<Token>& tokens) const;
     std::string detokenize(const std::vector<Token>& tokens,
                            Ranges& ranges, bool merge_ranges = false) const;
@@ -122,14 +208,54 @@ namespace onmt
     }
 
   private:
+    // The per character and per token loops are compiled for these modes with the default
+    // values of the options that are checked in the loops. Other options use the generic
+    // kernel. The kernel is selected whenever the options are set.
+    enum class Kernel
+    {
+      Generic,
+      Conservative,
+      Aggressive,
+      None,
+    };
+
     Options _options;
     std::shared_ptr<const SubwordEncoder> _subword_encoder;
+    Kernel _kernel = Kernel::Generic;
 
+    void select_kernel();
+    template <typename Policy>
     void tokenize_on_placeholders(const std::string& text,
-                                  std::vector<Token>& annotated_tokens) const;
+                                  TokenBatch& annotated_tokens,
+                                  TokenizationWorkspace& workspace,
+                                  const Policy& policy) const;
+    template <typename Policy>
     void tokenize_text(const std::string& text,
-                       std::vector<Token>& annotated_tokens,
-                       std::unordered_map<std::string, size_t>* alphabets) const;
+                       TokenBatch& annotated_tokens,
+                       std::unordered_map<std::string, size_t>* alphabets,
+                       TokenizationWorkspace& workspace,
+                       const Policy& policy) const;
+    template <typename Function>
+    void for_each_final_token(const std::vector<Token>& annotated_tokens,
+                              std::string& buffer,
+                              const Function& function) const;
+    template <typename Policy, typename Function>
+    void for_each_final_token(const std::vector<Token>& annotated_tokens,
+                              std::string& buffer,
+                              const Function& function,
+                              const Policy& policy) const;
+    void tokenize_spans(const std::string& text,
+                        TokenBatch& batch,
+                        std::unordered_map<std::string, size_t>* alphabets,
+                        TokenizationWorkspace& workspace) const;
+    // Returns true if tokens are lowercased by tokenize_text, in the same pass as the
+    // segmentation.
+    bool lowercase_while_segmenting() const;
+    void lowercase_and_encode(std::vector<Token>& annotated_tokens, bool training) const;
+    void finalize_tokens(const std::vector<Token>& annotated_tokens,
+                         std::string& output,
+                         const std::string& tokens_delimiter,
+                         std::string& buffer) const;
 
     void tokenize(const std::string& text,
                   std::vector<Token>& annotated_tokens,
@@ -140,6 +266,25 @@ namespace onmt
                   std::vector<std::vector<std::string> >& features,
                   std::unordered_map<std::string, size_t>* alphabets,
                   bool training) const;
+    void tokenize(const std::string& text,
+                  std::vector<Token>& annotated_tokens,
+                  std::unordered_map<std::string, size_t>* alphabets,
+                  TokenizationWorkspace& workspace,
+                  bool training) const;
+    template <typename VocabType>
+    void tokenize_to_ids(const std::string& text,
+                         const VocabType& vocab,
+                         std::vector<int32_t>& ids,
+                         TokenizationWorkspace& workspace,
+                         bool training) const;
+    template <typename VocabType>
+    void tokenize_batch_to_ids(const std::vector<std::string>& texts,
+                               const VocabType& vocab,
+                               std::vector<int32_t>& ids,
+                               std::vector<size_t>& lengths,
+                               int32_t padding_id,
+                               size_t num_threads,
+                               bool training) const;
     std::string detokenize(const std::vector<Token>& tokens,
                            Ranges* ranges,
                            bool merge_ranges = false,
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstdint>
 #include <istream>
 #include <limits>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -63,7 +66,20 @@ namespace onmt
 
     void add_token(std::string token, size_t count = 1);
     void add_from_text(const std::string& text, const Tokenizer* tokenizer = nullptr);
-    void add_from_stream(std::istream& is, const Tokenizer* tokenizer = nullptr);
+
+    // With num_threads > 1, batches of lines are tokenized in parallel into partial
+    // vocabularies which are merged in order, so the IDs do not depend on the number
+    // of threads.
+    void add_from_stream(std::istream& is,
+                         const Tokenizer* tokenizer = nullptr,
+                         size_t num_threads = 1);
+    void add_from_files(const std::vector<std::string>& paths,
+                        const Tokenizer* tokenizer = nullptr,
+                        size_t num_threads = 1);
+
+    // Adds the tokens and counters of another vocabulary. The new tokens are added in the
+    // order of their ID in the other vocabulary, and special tokens remain special.
+    void merge(const Vocab& other);
     void resize(size_t maximum_size = 0, size_t minimum_frequency = 1);
 
     void set_default_id(size_t id)
@@ -88,4 +104,53 @@ namespace onmt
     size_t _default_id = std::numeric_limits<size_t>::max();
   };
 
+  // Immutable vocabulary using less memory than Vocab: the tokens are concatenated in a
+  // single buffer and looked up in an open addressing table of IDs. It can be saved in a
+  // binary file which is memory mapped when loaded, so the pages are shared between
+  // processes.
+  class OPENNMTTOKENIZER_EXPORT FrozenVocab
+  {
+  public:
+    // Freezes the current tokens, counters, and default ID of the vocabulary.
+    FrozenVocab(const Vocab& vocab);
+    // Loads a vocabulary saved with save().
+    explicit FrozenVocab(const std::string& path);
+
+    void save(const std::string& path) const;
+
+    size_t lookup(std::string_view token) const;
+    std::string_view lookup(size_t id) const;
+    bool contains(std::string_view token) const;
+
+    size_t size() const
+    {
+      return _size;
+    }
+
+    size_t get_default_id() const
+    {
+      return _default_id;
+    }
+
+    size_t counter(size_t id) const
+    {
+      return _frequencies[id];
+    }
+
+  private:
+    std::shared_ptr<const void> _storage;
+    const char* _data;
+    size_t _data_size;
+    size_t _size;
+    size_t _default_id;
+    size_t _table_size;
+    const uint32_t* _tokens_offset;
+    const char* _tokens_data;
+    const int32_t* _table;
+    const uint64_t* _frequencies;
+
+    void init(std::shared_ptr<const void> storage, const char* data, size_t size);
+    size_t find(std::string_view token) const;
+  };
+
 }
@@ -83,6 +83,16 @@ namespace onmt
     };
 
     OPENNMTTOKENIZER_EXPORT std::vector<CharInfo> get_characters_info(const std::string& str);
+    // Same as above but reuses the memory of chars.
+    OPENNMTTOKENIZER_EXPORT void get_characters_info(const std::string& str,
+                                                     std::vector<CharInfo>& chars);
+    // Decodes the characters in [data, end) until max_chars characters are appended to chars.
+    // Returns the position of the next character to decode, which is end when the text is
+    // fully decoded. As for the functions above, *end should be a null character.
+    OPENNMTTOKENIZER_EXPORT const char* get_characters_info(const char* data,
+                                                            const char* end,
+                                                            size_t max_chars,
+                                                            std::vector<CharInfo>& chars);
 
 
     // The symbols below are deprecated but kept for backward compatibility.
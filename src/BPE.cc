@@ -1,13 +1,20 @@
 #include "onmt/BPE.h"
 
 #include <algorithm>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <limits>
+#include <queue>
 #include <random>
+#include <string_view>
+#include <unordered_map>
 
 #include "onmt/Tokenizer.h"
 #include "onmt/unicode/Unicode.h"
 #include "Casing.h"
+#include "MappedFile.h"
 #include "Utils.h"
 
 namespace onmt
@@ -59,7 +66,384 @@ namespace onmt
     _tokenization_options.joiner = joiner;
   }
 
+  // Compiled models start with a header followed by these sections, each aligned on
+  // 8 bytes: begin of word marker, end of word marker, symbols offset, symbols data,
+  // symbols table, symbols info, and merges table. Integers use the native byte order.
+  static constexpr char compiled_model_magic[8] = {'O', 'N', 'M', 'T', 'B', 'P', 'E', '\0'};
+  static constexpr uint32_t compiled_model_format_version = 1;
+  static constexpr uint32_t compiled_model_byte_order = 0x01020304;
+
+  static constexpr uint32_t compiled_model_prefix_flag = 1 << 0;
+  static constexpr uint32_t compiled_model_suffix_flag = 1 << 1;
+  static constexpr uint32_t compiled_model_case_insensitive_flag = 1 << 2;
+
+  struct CompiledModelHeader
+  {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t byte_order;
+    uint32_t flags;
+    int32_t version_major;
+    int32_t version_minor;
+    uint32_t begin_of_word_size;
+    uint32_t end_of_word_size;
+    uint32_t num_symbols;
+    uint32_t symbols_data_size;
+    uint32_t symbols_table_size;
+    uint32_t merges_table_size;
+    uint32_t reserved;
+  };
+
+  struct SymbolInfo
+  {
+    int32_t rank;  // Rank of the merge producing the symbol, or -1.
+    int32_t left;  // Symbols merged into this symbol.
+    int32_t right;
+  };
+
+  struct Merge
+  {
+    uint64_t pair;  // (left ID << 32) | right ID
+    int32_t rank;
+    int32_t symbol;
+  };
+
+  struct CompiledModelLayout
+  {
+    size_t begin_of_word;
+    size_t end_of_word;
+    size_t symbols_offset;
+    size_t symbols_data;
+    size_t symbols_table;
+    size_t symbols_info;
+    size_t merges_table;
+    size_t size;
+
+    CompiledModelLayout(const CompiledModelHeader& header)
+    {
+      SectionsLayout layout(sizeof (CompiledModelHeader));
+      begin_of_word = layout.add_section(header.begin_of_word_size, 1);
+      end_of_word = layout.add_section(header.end_of_word_size, 1);
+      symbols_offset = layout.add_section(uint64_t(header.num_symbols) + 1, sizeof (uint32_t));
+      symbols_data = layout.add_section(header.symbols_data_size, 1);
+      symbols_table = layout.add_section(header.symbols_table_size, sizeof (int32_t));
+      symbols_info = layout.add_section(header.num_symbols, sizeof (SymbolInfo));
+      merges_table = layout.add_section(header.merges_table_size, sizeof (Merge));
+      size = layout.size();
+    }
+  };
+
+  static inline uint64_t get_pair_key(int left, int right)
+  {
+    return (static_cast<uint64_t>(left) << 32) | static_cast<uint32_t>(right);
+  }
+
+  static inline uint64_t hash_pair_key(uint64_t key)
+  {
+    key *= 0x9E3779B97F4A7C15ULL;
+    return key ^ (key >> 32);
+  }
+
+  static constexpr uint64_t empty_pair_key = std::numeric_limits<uint64_t>::max();
+  static const std::pair<int, int> no_merge(std::numeric_limits<int>::max(), -1);
+
+
+  class BPE::CompiledModel
+  {
+  public:
+    // The model only references the data which is owned by storage.
+    CompiledModel(std::shared_ptr<const void> storage, const char* data, size_t size)
+      : _storage(std::move(storage))
+      , _data(data)
+      , _size(size)
+    {
+      if (size < sizeof (CompiledModelHeader))
+        throw std::invalid_argument("Invalid compiled BPE model");
+
+      _header = reinterpret_cast<const CompiledModelHeader*>(data);
+      if (std::memcmp(_header->magic, compiled_model_magic, sizeof (compiled_model_magic)) != 0)
+        throw std::invalid_argument("Invalid compiled BPE model");
+      if (_header->byte_order != compiled_model_byte_order)
+        throw std::invalid_argument("The compiled BPE model was saved with a different byte order");
+      if (_header->format_version != compiled_model_format_version)
+        throw std::invalid_argument("Unsupported compiled BPE model version");
+
+      const CompiledModelLayout layout(*_header);
+      if (layout.size != size
+          || _header->num_symbols > uint32_t(std::numeric_limits<int32_t>::max())
+          || !is_power_of_two(_header->symbols_table_size)
+          || !is_power_of_two(_header->merges_table_size))
+        throw std::invalid_argument("Invalid compiled BPE model");
+
+      _symbols_offset = reinterpret_cast<const uint32_t*>(data + layout.symbols_offset);
+      _symbols_data = data + layout.symbols_data;
+      _symbols_table = reinterpret_cast<const int32_t*>(data + layout.symbols_table);
+      _symbols_info = reinterpret_cast<const SymbolInfo*>(data + layout.symbols_info);
+      _merges_table = reinterpret_cast<const Merge*>(data + layout.merges_table);
+      _begin_of_word = std::string_view(data + layout.begin_of_word, _header->begin_of_word_size);
+      _end_of_word = std::string_view(data + layout.end_of_word, _header->end_of_word_size);
+
+      if (!is_valid_offsets(_symbols_offset, _header->num_symbols, _header->symbols_data_size)
+          || !is_valid_ids_table(_symbols_table,
+                                 _header->symbols_table_size,
+                                 _header->num_symbols)
+          || !is_valid_symbols_info()
+          || !is_valid_merges_table())
+        throw std::invalid_argument("Invalid compiled BPE model");
+    }
+
+    const CompiledModelHeader& header() const
+    {
+      return *_header;
+    }
+
+    const char* data() const
+    {
+      return _data;
+    }
+
+    size_t size() const
+    {
+      return _size;
+    }
+
+    std::string_view begin_of_word() const
+    {
+      return _begin_of_word;
+    }
+
+    std::string_view end_of_word() const
+    {
+      return _end_of_word;
+    }
+
+    std::string_view get_symbol(int id) const
+    {
+      return std::string_view(_symbols_data + _symbols_offset[id],
+                              _symbols_offset[id + 1] - _symbols_offset[id]);
+    }
+
+    const SymbolInfo& get_symbol_info(int id) const
+    {
+      return _symbols_info[id];
+    }
+
+    int get_symbol_id(std::string_view symbol) const
+    {
+      const size_t mask = _header->symbols_table_size - 1;
+      for (size_t slot = hash_string(symbol) & mask;; slot = (slot + 1) & mask)
+      {
+        const int id = _symbols_table[slot];
+        if (id < 0 || get_symbol(id) == symbol)
+          return id;
+      }
+    }
+
+    // Returns the merge rank and the merged symbol, or no_merge.
+    std::pair<int, int> find_merge(int left, int right) const
+    {
+      const uint64_t key = get_pair_key(left, right);
+      const size_t mask = _header->merges_table_size - 1;
+      for (size_t slot = hash_pair_key(key) & mask;; slot = (slot + 1) & mask)
+      {
+        const Merge& merge = _merges_table[slot];
+        if (merge.pair == key)
+          return std::make_pair(merge.rank, merge.symbol);
+        if (merge.pair == empty_pair_key)
+          return no_merge;
+      }
+    }
+
+  private:
+    bool is_valid_symbol_id(int id) const
+    {
+      return id >= 0 && static_cast<uint32_t>(id) < _header->num_symbols;
+    }
+
+    // Merged symbols are split recursively into their left and right symbols, which should
+    // then be non empty symbols that are concatenated into the merged symbol.
+    bool is_valid_symbols_info() const
+    {
+      for (uint32_t id = 0; id < _header->num_symbols; ++id)
+      {
+        const SymbolInfo& info = _symbols_info[id];
+        if (info.rank < 0)
+          continue;
+        if (!is_valid_symbol_id(info.left) || !is_valid_symbol_id(info.right))
+          return false;
+        const std::string_view symbol = get_symbol(id);
+        const std::string_view left = get_symbol(info.left);
+        const std::string_view right = get_symbol(info.right);
+        if (left.empty()
+            || right.empty()
+            || left.size() + right.size() != symbol.size()
+            || symbol.substr(0, left.size()) != left
+            || symbol.substr(left.size()) != right)
+          return false;
+      }
+      return true;
+    }
+
+    bool is_valid_merges_table() const
+    {
+      bool has_empty_slot = false;
+      for (uint32_t i = 0; i < _header->merges_table_size; ++i)
+      {
+        const Merge& merge = _merges_table[i];
+        if (merge.pair == empty_pair_key)
+          has_empty_slot = true;
+        else if (!is_valid_symbol_id(merge.symbol))
+          return false;
+      }
+      return has_empty_slot;
+    }
+
+    const std::shared_ptr<const void> _storage;
+    const char* _data;
+    size_t _size;
+    const CompiledModelHeader* _header;
+    const uint32_t* _symbols_offset;
+    const char* _symbols_data;
+    const int32_t* _symbols_table;
+    const SymbolInfo* _symbols_info;
+    const Merge* _merges_table;
+    std::string_view _begin_of_word;
+    std::string_view _end_of_word;
+  };
+
+  template <typename T>
+  static inline void copy_section(std::vector<uint64_t>& buffer,
+                                  size_t offset,
+                                  const T* data,
+                                  size_t size)
+  {
+    if (size > 0)
+      std::memcpy(reinterpret_cast<char*>(buffer.data()) + offset, data, size * sizeof (T));
+  }
+
+  // Returns the compiled model image in 8 bytes words to align all sections.
+  static std::shared_ptr<const std::vector<uint64_t>>
+  build_compiled_model(CompiledModelHeader header,
+                       const std::string& begin_of_word,
+                       const std::string& end_of_word,
+                       const std::vector<std::string>& symbols,
+                       const std::unordered_map<std::string, int>& symbol_ids,
+                       const std::vector<SymbolInfo>& symbols_info)
+  {
+    std::string symbols_data;
+    std::vector<uint32_t> symbols_offset;
+    symbols_offset.reserve(symbols.size() + 1);
+    symbols_offset.emplace_back(0);
+    for (const auto& symbol : symbols)
+    {
+      symbols_data.append(symbol);
+      symbols_offset.emplace_back(symbols_data.size());
+    }
+
+    std::vector<int32_t> symbols_table(get_table_size(symbols.size()), -1);
+    const size_t symbols_mask = symbols_table.size() - 1;
+    for (size_t id = 0; id < symbols.size(); ++id)
+    {
+      size_t slot = hash_string(symbols[id]) & symbols_mask;
+      while (symbols_table[slot] >= 0)
+        slot = (slot + 1) & symbols_mask;
+      symbols_table[slot] = id;
+    }
+
+    // A pair of symbols can be merged when their concatenation is a merged symbol,
+    // so we register all the ways to split merged symbols into 2 known symbols.
+    std::vector<Merge> merges;
+    merges.reserve(symbols.size());
+    for (size_t id = 0; id < symbols.size(); ++id)
+    {
+      const int rank = symbols_info[id].rank;
+      if (rank < 0)
+        continue;
+
+      const std::string& symbol = symbols[id];
+      for (size_t split = 1; split < symbol.size(); ++split)
+      {
+        const auto left = symbol_ids.find(symbol.substr(0, split));
+        if (left == symbol_ids.end())
+          continue;
+        const auto right = symbol_ids.find(symbol.substr(split));
+        if (right == symbol_ids.end())
+          continue;
+        merges.emplace_back(Merge{get_pair_key(left->second, right->second),
+                                  rank,
+                                  static_cast<int32_t>(id)});
+      }
+    }
+
+    std::vector<Merge> merges_table(get_table_size(merges.size()), Merge{empty_pair_key, -1, -1});
+    const size_t merges_mask = merges_table.size() - 1;
+    for (const auto& merge : merges)
+    {
+      size_t slot = hash_pair_key(merge.pair) & merges_mask;
+      while (merges_table[slot].pair != empty_pair_key)
+        slot = (slot + 1) & merges_mask;
+      merges_table[slot] = merge;
+    }
+
+    std::memcpy(header.magic, compiled_model_magic, sizeof (compiled_model_magic));
+    header.format_version = compiled_model_format_version;
+    header.byte_order = compiled_model_byte_order;
+    header.begin_of_word_size = begin_of_word.size();
+    header.end_of_word_size = end_of_word.size();
+    header.num_symbols = symbols.size();
+    header.symbols_data_size = symbols_data.size();
+    header.symbols_table_size = symbols_table.size();
+    header.merges_table_size = merges_table.size();
+    header.reserved = 0;
+
+    const CompiledModelLayout layout(header);
+    auto buffer = std::make_shared<std::vector<uint64_t>>(layout.size / sizeof (uint64_t), 0);
+    copy_section(*buffer, 0, &header, 1);
+    copy_section(*buffer, layout.begin_of_word, begin_of_word.data(), begin_of_word.size());
+    copy_section(*buffer, layout.end_of_word, end_of_word.data(), end_of_word.size());
+    copy_section(*buffer, layout.symbols_offset, symbols_offset.data(), symbols_offset.size());
+    copy_section(*buffer, layout.symbols_data, symbols_data.data(), symbols_data.size());
+    copy_section(*buffer, layout.symbols_table, symbols_table.data(), symbols_table.size());
+    copy_section(*buffer, layout.symbols_info, symbols_info.data(), symbols_info.size());
+    copy_section(*buffer, layout.merges_table, merges_table.data(), merges_table.size());
+    return buffer;
+  }
+
+  static bool is_compiled_model(const std::string& model_path)
+  {
+    std::ifstream in(model_path, std::ios::binary);
+    if (!in)
+      throw std::invalid_argument("Unable to open BPE model " + model_path);
+
+    char magic[sizeof (compiled_model_magic)];
+    in.read(magic, sizeof (magic));
+    return (in.gcount() == sizeof (magic)
+            && std::memcmp(magic, compiled_model_magic, sizeof (magic)) == 0);
+  }
+
   void BPE::load_model(const std::string& model_path)
+  {
+    if (!is_compiled_model(model_path))
+    {
+      load_text_model(model_path);
+      return;
+    }
+
+    auto file = std::make_shared<const MappedFile>(model_path);
+    const char* data = file->data();
+    const size_t size = file->size();
+    _model = std::make_shared<const CompiledModel>(std::move(file), data, size);
+
+    const auto& header = _model->header();
+    _prefix = header.flags & compiled_model_prefix_flag;
+    _suffix = header.flags & compiled_model_suffix_flag;
+    _case_insensitive = header.flags & compiled_model_case_insensitive_flag;
+    _version = std::make_pair(header.version_major, header.version_minor);
+    _begin_of_word = _model->begin_of_word();
+    _end_of_word = _model->end_of_word();
+  }
+
+  void BPE::load_text_model(const std::string& model_path)
   {
     std::ifstream in(model_path.c_str());
 
@@ -68,8 +452,6 @@ namespace onmt
 
     std::string line;
 
-    int i = 0;
-
     std::getline(in, line);
 
     if (starts_with(line, "#version:"))  // Model from learn_bpe.py
@@ -108,6 +490,20 @@ namespace onmt
         in.seekg(0);
     }
 
+    std::unordered_map<std::string, int> symbol_ids;
+    std::vector<std::string> symbols;
+    std::vector<SymbolInfo> symbols_info;
+    const auto add_symbol = [&symbol_ids, &symbols, &symbols_info](std::string symbol) {
+      const auto pair = symbol_ids.emplace(std::move(symbol), symbols.size());
+      if (pair.second)
+      {
+        symbols.emplace_back(pair.first->first);
+        symbols_info.emplace_back(SymbolInfo{-1, -1, -1});
+      }
+      return pair.first->second;
+    };
+
+    int rank = 0;
     bool header = true;
     while (std::getline(in, line))
     {
@@ -115,19 +511,60 @@ namespace onmt
       if (header && !line.empty() && line[0] == '#')
         continue;
       header = false;
+      // Merges with an empty symbol can not be applied.
       size_t sep = line.find(' ');
-      if (sep != std::string::npos && sep + 1 < line.size())
+      if (sep != std::string::npos && sep > 0 && sep + 1 < line.size())
       {
-        std::string first_token = line.substr(0, sep);
-        std::string second_token = line.substr(sep + 1);
-        std::string pair = first_token + second_token;
-        if (_codes.count(pair) == 0)
-          _codes.emplace(pair, i++);
-
-        _codes_reverse.emplace(std::move(pair),
-                               std::make_pair(std::move(first_token), std::move(second_token)));
+        const int first = add_symbol(line.substr(0, sep));
+        const int second = add_symbol(line.substr(sep + 1));
+        const int merged = add_symbol(line.erase(sep, 1));
+        if (symbols_info[merged].rank < 0)
+          symbols_info[merged] = SymbolInfo{rank++, first, second};
       }
     }
+
+    CompiledModelHeader model_header;
+    model_header.flags = ((_prefix ? compiled_model_prefix_flag : 0)
+                          | (_suffix ? compiled_model_suffix_flag : 0)
+                          | (_case_insensitive ? compiled_model_case_insensitive_flag : 0));
+    model_header.version_major = _version.first;
+    model_header.version_minor = _version.second;
+    auto buffer = build_compiled_model(model_header,
+                                       _begin_of_word,
+                                       _end_of_word,
+                                       symbols,
+                                       symbol_ids,
+                                       symbols_info);
+    const char* data = reinterpret_cast<const char*>(buffer->data());
+    const size_t size = buffer->size() * sizeof (uint64_t);
+    _model = std::make_shared<const CompiledModel>(std::move(buffer), data, size);
+  }
+
+  void BPE::save_compiled_model(const std::string& path) const
+  {
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+      throw std::invalid_argument("Failed to open model path " + path);
+    out.write(_model->data(), _model->size());
+    if (!out)
+      throw std::runtime_error("Failed to write the compiled BPE model to " + path);
+  }
+
+  std::pair<int, int> BPE::get_merge(int left,
+                                     int right,
+                                     const std::vector<std::string>& pieces) const
+  {
+    if (left >= 0 && right >= 0)
+      return _model->find_merge(left, right);
+
+    // Pieces that are not symbols of the model have a negative ID. They are rare
+    // so we simply look up the concatenated string.
+    std::string merged(left >= 0 ? _model->get_symbol(left) : pieces[-left - 1]);
+    merged += (right >= 0 ? _model->get_symbol(right) : pieces[-right - 1]);
+    const int symbol = _model->get_symbol_id(merged);
+    if (symbol >= 0 && _model->get_symbol_info(symbol).rank >= 0)
+      return std::make_pair(_model->get_symbol_info(symbol).rank, symbol);
+    return no_merge;
   }
 
   std::vector<std::string> BPE::get_initial_pieces(const std::vector<unicode::CharInfo>& chars,
@@ -162,7 +599,10 @@ namespace onmt
           pieces.back().append(c.data, c.length);
       }
       else if (lowercase && c.case_type == unicode::CaseType::Upper)
-        pieces.emplace_back(unicode::cp_to_utf8(unicode::get_lower(c.value)));
+      {
+        char buffer[4];
+        pieces.emplace_back(buffer, lowercase_char(c.value, buffer));
+      }
       else
         pieces.emplace_back(c.data, c.length);
     }
@@ -233,7 +673,10 @@ namespace onmt
         {
           const auto& char_tc = chars_info[char_index];
           if (char_tc.case_type == unicode::CaseType::Upper)
-            length_lc += unicode::cp_to_utf8(unicode::get_lower(char_tc.value)).size();
+          {
+            char buffer[4];
+            length_lc += lowercase_char(char_tc.value, buffer);
+          }
           else
             length_lc += char_tc.length;
           word_tc.append(char_tc.data, char_tc.length);
@@ -247,9 +690,14 @@ namespace onmt
     return chars;
   }
 
+  bool BPE::is_sampling(bool training) const
+  {
+    return training && _dropout != 0;
+  }
+
   std::vector<Token> BPE::encode_and_annotate(const Token& token, bool training) const
   {
-    std::vector<std::string> encoded = encode(token.surface, training);
+    std::vector<std::string> encoded = encode_with_cache(token.surface, training);
     std::vector<Token> tokens;
     tokens.reserve(encoded.size());
 
@@ -278,62 +726,177 @@ namespace onmt
     return tokens;
   }
 
-  int BPE::get_score(const std::string& gram1, const std::string& gram2) const
+  void BPE::apply_merges(std::vector<std::string>& pieces, bool training) const
   {
-    auto it = _codes.find(gram1 + gram2);
-    if (it != _codes.end())
-      return it->second;
+    // Merges are applied on symbol IDs. Pieces that are not symbols of the model
+    // are identified by their negative index.
+    std::vector<int> symbols;
+    symbols.reserve(pieces.size());
+    for (size_t i = 0; i < pieces.size(); ++i)
+    {
+      const int id = _model->get_symbol_id(pieces[i]);
+      symbols.emplace_back(id >= 0 ? id : -static_cast<int>(i) - 1);
+    }
+
+    // The dropout variant samples every pair at each merge step. It is kept as a separate
+    // scan so that random sequences (and thus seeded outputs) are unchanged.
+    if (training && _dropout != 0)
+      apply_merges_with_dropout(symbols, pieces);
     else
-      return std::numeric_limits<int>::max();
+      apply_merges_with_queue(symbols, pieces);
+
+    // Materialize the merged pieces. A piece that was never merged comes from an index
+    // that is greater or equal to its new position so it can be moved in place.
+    for (size_t i = 0; i < symbols.size(); ++i)
+    {
+      const int id = symbols[i];
+      if (id >= 0)
+      {
+        const std::string_view symbol = _model->get_symbol(id);
+        pieces[i].assign(symbol.data(), symbol.size());
+      }
+      else if (static_cast<size_t>(-id - 1) != i)
+        pieces[i] = std::move(pieces[-id - 1]);
+    }
+    pieces.resize(symbols.size());
   }
 
-  void BPE::apply_merges(std::vector<std::string>& chars, bool training) const
+  namespace
   {
-    // Compute score for all pairs.
-    std::vector<int> scores;
-    scores.reserve(chars.size() - 1);
-    for (size_t i = 0; i + 1 < chars.size(); ++i)
-      scores.push_back(get_score(chars[i], chars[i + 1]));
+    struct MergeCandidate
+    {
+      int rank;
+      int left;
+      int right;
+      int left_symbol;  // Symbols are used to detect outdated candidates.
+      int right_symbol;
+      int symbol;
+
+      bool operator>(const MergeCandidate& other) const
+      {
+        // The leftmost pair is merged first when ranks are equal.
+        return rank > other.rank || (rank == other.rank && left > other.left);
+      }
+    };
+  }
+
+  void BPE::apply_merges_with_queue(std::vector<int>& symbols,
+                                    const std::vector<std::string>& pieces) const
+  {
+    // Symbols form a doubly linked list: merging a pair replaces the left symbol by the
+    // merged symbol and unlinks the right symbol. Candidate pairs are ordered in a min-heap
+    // and outdated entries are skipped when they are popped.
+    const int num_symbols = symbols.size();
+    if (num_symbols < 2)
+      return;
+
+    std::vector<int> prev(num_symbols);
+    std::vector<int> next(num_symbols);
+    for (int i = 0; i < num_symbols; ++i)
+    {
+      prev[i] = i - 1;
+      next[i] = i + 1 < num_symbols ? i + 1 : -1;
+    }
+
+    std::vector<MergeCandidate> heap_storage;
+    heap_storage.reserve(num_symbols);
+    std::priority_queue<MergeCandidate,
+                        std::vector<MergeCandidate>,
+                        std::greater<MergeCandidate>> candidates(std::greater<MergeCandidate>(),
+                                                                 std::move(heap_storage));
+
+    const auto add_candidate = [this, &symbols, &pieces, &candidates](int left, int right) {
+      const auto merge = get_merge(symbols[left], symbols[right], pieces);
+      if (merge.second >= 0)
+        candidates.push(MergeCandidate{merge.first,
+                                       left,
+                                       right,
+                                       symbols[left],
+                                       symbols[right],
+                                       merge.second});
+    };
+
+    for (int i = 0; i + 1 < num_symbols; ++i)
+      add_candidate(i, i + 1);
+
+    while (!candidates.empty())
+    {
+      const MergeCandidate candidate = candidates.top();
+      candidates.pop();
+
+      const int left = candidate.left;
+      const int right = candidate.right;
+      if (next[left] != right
+          || symbols[left] != candidate.left_symbol
+          || symbols[right] != candidate.right_symbol)
+        continue;
+
+      // Merge pair.
+      symbols[left] = candidate.symbol;
+      next[left] = next[right];
+      next[right] = -1;
+      if (next[left] != -1)
+        prev[next[left]] = left;
+
+      // Score the new pairs (prev,left) and (left,next).
+      if (prev[left] != -1)
+        add_candidate(prev[left], left);
+      if (next[left] != -1)
+        add_candidate(left, next[left]);
+    }
+
+    // Compact the remaining symbols.
+    size_t num_merged = 0;
+    for (int i = 0; i != -1; i = next[i])
+      symbols[num_merged++] = symbols[i];
+    symbols.resize(num_merged);
+  }
+
+  void BPE::apply_merges_with_dropout(std::vector<int>& symbols,
+                                      const std::vector<std::string>& pieces) const
+  {
+    // Compute rank and merged symbol for all pairs.
+    std::vector<std::pair<int, int>> merges;
+    merges.reserve(symbols.size() - 1);
+    for (size_t i = 0; i + 1 < symbols.size(); ++i)
+      merges.emplace_back(get_merge(symbols[i], symbols[i + 1], pieces));
 
     while (true)
     {
-      // Get best score.
-      int best_score = std::numeric_limits<int>::max();
+      // Get best rank.
+      int best_rank = std::numeric_limits<int>::max();
       size_t index = 0;
 
-      for (size_t i = 0; i < scores.size(); ++i)
+      for (size_t i = 0; i < merges.size(); ++i)
       {
-        if (training && _dropout != 0)
-        {
-          std::uniform_real_distribution<float> dist;
-          const float sample = dist(get_random_generator());
-          if (sample < _dropout)
-            continue;
-        }
+        std::uniform_real_distribution<float> dist;
+        const float sample = dist(get_random_generator());
+        if (sample < _dropout)
+          continue;
 
-        const int score = scores[i];
-        if (score < best_score)
+        const int rank = merges[i].first;
+        if (rank < best_rank)
         {
-          best_score = score;
+          best_rank = rank;
           index = i;
         }
       }
 
-      if (best_score == std::numeric_limits<int>::max())
+      if (best_rank == std::numeric_limits<int>::max())
         break;
 
       // Merge pair.
-      chars[index] += chars[index + 1];
-      chars.erase(chars.begin() + index + 1);
-      if (chars.size() == 1)
+      symbols[index] = merges[index].second;
+      symbols.erase(symbols.begin() + index + 1);
+      if (symbols.size() == 1)
         break;
 
-      // Update score of pairs (index-1,index) and (index,index+1).
+      // Update merges of pairs (index-1,index) and (index,index+1).
       if (index > 0)
-        scores[index - 1] = get_score(chars[index - 1], chars[index]);
-      if (index + 1 < chars.size())
-        scores[index] = get_score(chars[index], chars[index + 1]);
-      scores.erase(scores.begin() + std::min(index + 1, chars.size() - 1));
+        merges[index - 1] = get_merge(symbols[index - 1], symbols[index], pieces);
+      if (index + 1 < symbols.size())
+        merges[index] = get_merge(symbols[index], symbols[index + 1], pieces);
+      merges.erase(merges.begin() + std::min(index + 1, symbols.size() - 1));
     }
   }
 
@@ -420,17 +983,19 @@ namespace onmt
       right_offset = _end_of_word.size();
     }
 
-    auto it = _codes_reverse.find(bpe_surface);
-    if (it == _codes_reverse.end())
+    const int symbol = _model->get_symbol_id(bpe_surface);
+    if (symbol < 0 || _model->get_symbol_info(symbol).rank < 0)
     {
       pieces_in_vocab.emplace_back(std::move(piece));
       return;
     }
 
-    const auto& pair = it->second;
+    const auto& symbol_info = _model->get_symbol_info(symbol);
+    const std::string_view left_surface = _model->get_symbol(symbol_info.left);
+    const std::string_view right_surface = _model->get_symbol(symbol_info.right);
 
     {
-      Token left_piece(pair.first.substr(left_offset));
+      Token left_piece(std::string(left_surface.substr(left_offset)));
       left_piece.join_left = first && piece.join_left;
       left_piece.join_right = true;
       left_piece.preserve = first && piece.join_left && piece.preserve;
@@ -442,7 +1007,7 @@ namespace onmt
     }
 
     {
-      Token right_piece(pair.second.substr(0, pair.second.size() - right_offset));
+      Token right_piece(std::string(right_surface.substr(0, right_surface.size() - right_offset)));
       right_piece.join_left = false;
       right_piece.join_right = !last || piece.join_right;
       right_piece.preserve = last && piece.join_right && piece.preserve;
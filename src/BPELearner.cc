@@ -13,27 +13,28 @@ The code is converted from bpe_learn.py (https://github.com/rsennrich/subword-nm
 #include "onmt/BPELearner.h"
 
 #include <algorithm>
-#include <limits>
+#include <cstdint>
 #include <unordered_set>
 
 #include "onmt/BPE.h"
 #include "onmt/unicode/Unicode.h"
+#include "ThreadPool.h"
 
 namespace onmt
 {
-  typedef std::pair<std::string, std::string> bigram;
-  typedef std::vector<std::string> sequence;
-
   BPELearner::BPELearner(bool verbose,
                          int symbols,
                          int min_frequency,
                          bool dict_input,
-                         bool total_symbols)
-    : SubwordLearner(verbose, new Tokenizer(Tokenizer::Mode::Space))
+                         bool total_symbols,
+                         size_t num_threads,
+                         size_t max_vocab_size)
+    : SubwordLearner(verbose, new Tokenizer(Tokenizer::Mode::Space), num_threads)
     , _symbols(symbols)
     , _min_frequency(min_frequency)
     , _dict_input(dict_input)
     , _total_symbols(total_symbols)
+    , _max_vocab_size(max_vocab_size)
   {
   }
 
@@ -47,13 +48,76 @@ namespace onmt
       size_t p = line.find(" ");
       if (p == std::string::npos || line.find(" ", p + 1) != std::string::npos)
         throw std::runtime_error("Failed reading vocabulary file");
-      _vocab[line.substr(0, p)] += std::stoi(line.substr(p + 1));
+      add_word(line.substr(0, p), std::stoi(line.substr(p + 1)));
     }
   }
 
   void BPELearner::ingest_token_impl(const std::string& token)
   {
-    _vocab[token]++;
+    add_word(token, 1);
+  }
+
+  void BPELearner::ingest_batch(const std::vector<std::string>& lines, const Tokenizer& tokenizer)
+  {
+    // Each thread counts the words of a range of lines, and the counts are merged in order.
+    // The vocabulary is only reduced after the whole batch is merged so that the result
+    // does not depend on the number of threads.
+    const size_t num_ranges = get_num_ranges(lines.size(), _num_threads, 1);
+    std::vector<std::unordered_map<std::string, int>> counts(num_ranges);
+    ThreadPool::get_shared().parallel_for(num_ranges, num_ranges, [&](size_t r) {
+      const auto range = get_range(lines.size(), num_ranges, r);
+      std::vector<Token> tokens;
+      for (size_t i = range.first; i < range.second; ++i)
+      {
+        tokens.clear();
+        tokenizer.tokenize(lines[i], tokens);
+        for (const auto& token : tokens)
+        {
+          if (should_ingest(token))
+            counts[r][token.surface]++;
+        }
+      }
+    });
+
+    for (const auto& range_counts : counts)
+    {
+      for (const auto& count : range_counts)
+        _vocab[count.first] += count.second;
+    }
+
+    maybe_reduce_vocab();
+  }
+
+  void BPELearner::add_word(const std::string& word, int count)
+  {
+    _vocab[word] += count;
+    maybe_reduce_vocab();
+  }
+
+  void BPELearner::maybe_reduce_vocab()
+  {
+    if (_max_vocab_size == 0 || _vocab.size() <= _max_vocab_size)
+      return;
+
+    // Keep the most frequent words until a quarter of the capacity is free, so that
+    // this function is not called on every new word. Ties are broken on the words.
+    const size_t target_size = _max_vocab_size * 3 / 4;
+    using Entry = std::unordered_map<std::string, int>::iterator;
+    std::vector<Entry> entries;
+    entries.reserve(_vocab.size());
+    for (auto it = _vocab.begin(); it != _vocab.end(); ++it)
+      entries.push_back(it);
+
+    const auto removed = entries.begin() + target_size;
+    std::nth_element(entries.begin(), removed, entries.end(),
+                     [](const Entry& a, const Entry& b) {
+                       if (a->second != b->second)
+                         return a->second > b->second;
+                       return a->first < b->first;
+                     });
+
+    for (auto it = removed; it != entries.end(); ++it)
+      _vocab.erase(*it);
   }
 
   void BPELearner::ingest(std::istream& is, const Tokenizer* tokenizer)
@@ -64,229 +128,471 @@ namespace onmt
       SubwordLearner::ingest(is, tokenizer);
   }
 
-  struct Change {
-    Change(int j_,
-           const sequence& word_,
-           sequence&& old_word_,
-           int freq_)
-      : j(j_)
-      , word(word_)
-      , old_word(old_word_)
-      , freq(freq_) {
-    }
-
-    int j;
-    const sequence& word;
-    sequence old_word;
-    int freq;
-  };
+  // Symbols are interned so that words and pairs are stored as integers.
+  class SymbolTable {
+  public:
+    int32_t intern(const std::string& symbol) {
+      auto it = _ids.find(symbol);
+      if (it != _ids.end())
+        return it->second;
+      const int32_t id = _symbols.size();
+      _symbols.emplace_back(symbol);
+      _ids.emplace(symbol, id);
+      return id;
+    }
 
-  struct pair_hash {
-    template <typename T1, typename T2>
-    std::size_t operator () (const std::pair<T1, T2>& pair) const {
-      const std::size_t h1 = std::hash<T1>()(pair.first);
-      const std::size_t h2 = std::hash<T2>()(pair.second);
-      return h1 ^ h2;
+    const std::string& operator[](int32_t id) const {
+      return _symbols[id];
     }
+
+  private:
+    std::vector<std::string> _symbols;
+    std::unordered_map<std::string, int32_t> _ids;
   };
 
-  using bigram_collection = std::unordered_set<bigram, pair_hash>;
+  // A pair of symbols packed in 64 bits.
+  using symbol_pair = uint64_t;
 
-  static const bigram*
-  get_bigram(bigram_collection& collection,
-             const std::string& a,
-             const std::string& b) {
-    return &(*collection.emplace(a, b).first);
+  static inline symbol_pair make_pair_key(int32_t first, int32_t second) {
+    return (static_cast<uint64_t>(first) << 32) | static_cast<uint32_t>(second);
   }
 
-  static void
-  update_pair_statistics(bigram_collection& collection,
-                         const bigram* pair,
-                         const std::vector<Change>& changed,
-                         std::unordered_map<const bigram*, int>& stats,
-                         std::unordered_map<const bigram*, std::unordered_map<int, int>>& indices) {
-    /* Minimally update the indices and frequency of symbol pairs
+  static inline int32_t pair_first(symbol_pair pair) {
+    return static_cast<int32_t>(pair >> 32);
+  }
 
-    if we merge a pair of symbols, only pairs that overlap with occurrences
-    of this pair are affected, and need to be updated.
-    */
+  static inline int32_t pair_second(symbol_pair pair) {
+    return static_cast<int32_t>(pair & 0xffffffff);
+  }
 
-    stats[pair] = 0;
-    indices[pair] = std::unordered_map<int, int>();
-    const std::string &first = pair->first;
-    const std::string &second = pair->second;
+  // Hash map with open addressing and linear probing, keyed by symbol pairs.
+  // Entries are never removed.
+  template <typename T>
+  class PairMap {
+  public:
+    T& operator[](symbol_pair key) {
+      if ((_size + 1) * 2 > _slots.size())
+        grow();
+      Slot& slot = _slots[find_slot(key)];
+      if (slot.key == empty_key) {
+        slot.key = key;
+        ++_size;
+      }
+      return slot.value;
+    }
 
-    std::string new_pair = first + second;
+    size_t size() const {
+      return _size;
+    }
 
-    for(const auto& change : changed) {
-      const int j = change.j;
-      const sequence& word = change.word;
-      const sequence& old_word = change.old_word;
-      const int freq = change.freq;
+    bool empty() const {
+      return _size == 0;
+    }
 
-      // find all instances of pair, and update frequency/indices around it
-      size_t i = 0;
-      while (true) {
-        // find first symbol
-        auto it = std::find(old_word.begin() + i, old_word.end(), first);
-        if (it == old_word.end())
+    template <typename Function>
+    void for_each(const Function& function) const {
+      for (const auto& slot : _slots) {
+        if (slot.key != empty_key)
+          function(slot.key, slot.value);
+      }
+    }
+
+  private:
+    static constexpr symbol_pair empty_key = ~symbol_pair(0);
+
+    struct Slot {
+      symbol_pair key = empty_key;
+      T value{};
+    };
+
+    std::vector<Slot> _slots;
+    size_t _size = 0;
+
+    static size_t hash(symbol_pair key) {
+      key ^= key >> 33;
+      key *= 0xff51afd7ed558ccdULL;
+      key ^= key >> 33;
+      return key;
+    }
+
+    size_t find_slot(symbol_pair key) const {
+      const size_t mask = _slots.size() - 1;
+      size_t index = hash(key) & mask;
+      while (_slots[index].key != key && _slots[index].key != empty_key)
+        index = (index + 1) & mask;
+      return index;
+    }
+
+    void grow() {
+      std::vector<Slot> slots(std::max(_slots.size() * 2, size_t(16)));
+      slots.swap(_slots);
+      for (auto& slot : slots) {
+        if (slot.key != empty_key)
+          _slots[find_slot(slot.key)] = std::move(slot);
+      }
+    }
+  };
+
+  // Frequencies of the symbol pairs, with an indexed max-heap to get the most frequent
+  // pair in O(1) and update a frequency in O(log P).
+  class PairQueue {
+  public:
+    PairQueue(const SymbolTable& symbols)
+      : _symbols(symbols)
+    {
+    }
+
+    bool empty() const {
+      return _heap.empty();
+    }
+
+    // Returns the most frequent pair. Ties are broken on the symbol strings to have the
+    // same priority as previous versions of this code that iterated on a std::map.
+    std::pair<symbol_pair, int> top() const {
+      const int32_t id = _heap.front();
+      return std::make_pair(_pairs[id], _freqs[id]);
+    }
+
+    void add(symbol_pair pair, int delta) {
+      const int32_t id = get_id(pair);
+      update(id, _freqs[id] + delta);
+    }
+
+    void set(symbol_pair pair, int freq) {
+      update(get_id(pair), freq);
+    }
+
+  private:
+    const SymbolTable& _symbols;
+    PairMap<int32_t> _ids;  // Pair ID + 1.
+    std::vector<symbol_pair> _pairs;
+    std::vector<int> _freqs;
+    std::vector<size_t> _positions;
+    std::vector<int32_t> _heap;
+
+    int32_t get_id(symbol_pair pair) {
+      int32_t& id = _ids[pair];
+      if (id == 0) {
+        id = _pairs.size() + 1;
+        _pairs.emplace_back(pair);
+        _freqs.emplace_back(0);
+        _positions.emplace_back(_heap.size());
+        _heap.emplace_back(id - 1);
+        sift_up(_heap.size() - 1);
+      }
+      return id - 1;
+    }
+
+    void update(int32_t id, int freq) {
+      const int old_freq = _freqs[id];
+      _freqs[id] = freq;
+      if (freq > old_freq)
+        sift_up(_positions[id]);
+      else if (freq < old_freq)
+        sift_down(_positions[id]);
+    }
+
+    // Returns true if a should be selected before b.
+    bool before(int32_t a, int32_t b) const {
+      if (_freqs[a] != _freqs[b])
+        return _freqs[a] > _freqs[b];
+      const std::string& a_first = _symbols[pair_first(_pairs[a])];
+      const std::string& b_first = _symbols[pair_first(_pairs[b])];
+      if (a_first != b_first)
+        return a_first < b_first;
+      return _symbols[pair_second(_pairs[a])] < _symbols[pair_second(_pairs[b])];
+    }
+
+    void place(size_t position, int32_t id) {
+      _heap[position] = id;
+      _positions[id] = position;
+    }
+
+    void sift_up(size_t position) {
+      const int32_t id = _heap[position];
+      while (position > 0) {
+        const size_t parent = (position - 1) / 2;
+        if (!before(id, _heap[parent]))
           break;
-        i = it - old_word.begin();
-        // if first symbol is followed by second symbol, we've found an occurrence of pair (old_word[i:i+2])
-        if (i < old_word.size()-1 && old_word[i+1] == second) {
-          // assuming a symbol sequence "A B C", if "B C" is merged, reduce the frequency of "A B"
-          if (i > 0) {
-            const bigram* prev = get_bigram(collection, old_word[i-1], old_word[i]);
-            stats[prev] -= freq;
-            indices[prev][j] -= 1;
-          }
-          if (i < old_word.size()-2) {
-            // assuming a symbol sequence "A B C B", if "B C" is merged, reduce the frequency of "C B".
-            // however, skip this if the sequence is A B C B C, because the frequency of "C B" will be reduced by the previous code block
-            if (old_word[i+2] != first || i >= old_word.size()-3 || old_word[i+3] != second) {
-              const bigram* nex = get_bigram(collection, old_word[i+1], old_word[i+2]);
-              stats[nex] -= freq;
-              indices[nex][j] -= 1;
-            }
-          }
-          i += 2;
-        }
-        else
-          i += 1;
+        place(position, _heap[parent]);
+        position = parent;
       }
+      place(position, id);
+    }
 
-      i = 0;
+    void sift_down(size_t position) {
+      const int32_t id = _heap[position];
       while (true) {
-        // find new pair
-        auto it = std::find(word.begin() + i, word.end(), new_pair);
-        if (it == word.end())
+        size_t child = 2 * position + 1;
+        if (child >= _heap.size())
           break;
-        i = it - word.begin();
-        // assuming a symbol sequence "A BC D", if "B C" is merged, increase the frequency of "A BC"
-        if (i) {
-          const bigram* prev = get_bigram(collection, word[i-1], word[i]);
-          stats[prev] += freq;
-          indices[prev][j] += 1;
-        }
-        // assuming a symbol sequence "A BC B", if "B C" is merged, increase the frequency of "BC B"
-        // however, if the sequence is A BC BC, skip this step because the count of "BC BC" will be incremented by the previous code block
-        if (i < word.size()-1 && word[i+1] != new_pair) {
-          const bigram* nex = get_bigram(collection, word[i], word[i+1]);
-          stats[nex] += freq;
-          indices[nex][j] += 1;
-        }
-        i += 1;
+        if (child + 1 < _heap.size() && before(_heap[child + 1], _heap[child]))
+          ++child;
+        if (!before(_heap[child], id))
+          break;
+        place(position, _heap[child]);
+        position = child;
       }
+      place(position, id);
+    }
+  };
+
+  using pair_stats = PairQueue;
+  // Words that contained the pair when it was last counted. The lists can contain
+  // duplicates and words that no longer contain the pair.
+  using pair_indices = PairMap<std::vector<int32_t>>;
+
+  // The words sorted by decreasing frequency. The symbols of all words are stored in
+  // a single buffer, and merges shrink the words in place.
+  struct WordBuffer {
+    std::vector<int32_t> symbols;
+    std::vector<size_t> offsets;
+    std::vector<uint32_t> lengths;
+    std::vector<int> freqs;
+
+    size_t size() const {
+      return offsets.size();
+    }
+
+    const int32_t* begin(size_t j) const {
+      return symbols.data() + offsets[j];
+    }
+
+    const int32_t* end(size_t j) const {
+      return begin(j) + lengths[j];
     }
+  };
+
+  static void apply_update(pair_stats& stats,
+                           pair_indices& indices,
+                           symbol_pair pair,
+                           int32_t j,
+                           int count,
+                           int freq) {
+    stats.add(pair, count * freq);
+    if (count > 0)
+      indices[pair].emplace_back(j);
   }
 
-  static void
-  get_pair_statistics(bigram_collection& collection,
-                      const std::vector<std::pair<int, sequence>>& sorted_vocab,
-                      std::unordered_map<const bigram*, int>& stats,
-                      std::unordered_map<const bigram*, std::unordered_map<int, int>>& indices) {
-    /* Count frequency of all symbol pairs, and create index */
-    int max = 0;
-    for(size_t i = 0; i < sorted_vocab.size(); i++) {
-      const int freq = sorted_vocab[i].first;
-      const sequence &word = sorted_vocab[i].second;
-      for(size_t j = 1; j < word.size(); j++) {
-        const bigram* pair = get_bigram(collection, word[j-1], word[j]);
-        stats[pair] += freq;
-        max = std::max(stats[pair], max);
-        indices[pair][i] += 1;
-      }
+  // Update of the pair statistics: the pair frequency changes by count * freq(j).
+  struct PairUpdate {
+    symbol_pair pair;
+    int32_t j;
+    int32_t count;
+  };
+
+  // Applies the updates in order. The result does not depend on how the updates were
+  // split between threads since the statistics are sums.
+  static void apply_updates(const std::vector<std::vector<PairUpdate>>& updates,
+                            const WordBuffer& words,
+                            pair_stats& stats,
+                            pair_indices& indices) {
+    for (const auto& range_updates : updates) {
+      for (const auto& update : range_updates)
+        apply_update(stats, indices, update.pair, update.j, update.count, words.freqs[update.j]);
     }
   }
 
-  static std::vector<Change>
-  replace_pair(const bigram* pair,
-               std::vector<std::pair<int, sequence>>& sorted_vocab,
-               std::unordered_map<const bigram*, std::unordered_map<int, int>>& indices) {
-    /* Replace all occurrences of a symbol pair ('A', 'B') with a new symbol 'AB' */
-    const std::string &A = pair->first;
-    const std::string &B = pair->second;
-
-    const auto& pair_indices = indices[pair];
-    std::vector<Change> changes;
-    changes.reserve(pair_indices.size());
-    for (const auto& index : pair_indices) {
-      if (index.second < 1)
-        continue;
-      const int j = index.first;
-      sequence &word = sorted_vocab[j].second;
-      int freq = sorted_vocab[j].first;
-
-      sequence wordcopy = word;
-      for(size_t h=0; h < word.size()-1; h++)
-        if (word[h] == A && word[h+1] == B) {
-          word[h] += B;
-          word.erase(word.begin()+h+1);
+  // Calls add(pair, count) for each pair that is changed when merging (first, second)
+  // in the word.
+  template <typename Add>
+  static void get_pair_updates(int32_t first,
+                               int32_t second,
+                               int32_t new_pair,
+                               const int32_t* word,
+                               size_t word_size,
+                               const int32_t* old_word,
+                               size_t old_word_size,
+                               const Add& add) {
+    // find all instances of pair, and update frequency/indices around it
+    size_t i = 0;
+    while (true) {
+      // find first symbol
+      auto it = std::find(old_word + i, old_word + old_word_size, first);
+      if (it == old_word + old_word_size)
+        break;
+      i = it - old_word;
+      // if first symbol is followed by second symbol, we've found an occurrence of pair (old_word[i:i+2])
+      if (i < old_word_size-1 && old_word[i+1] == second) {
+        // assuming a symbol sequence "A B C", if "B C" is merged, reduce the frequency of "A B"
+        if (i > 0)
+          add(make_pair_key(old_word[i-1], old_word[i]), -1);
+        if (i < old_word_size-2) {
+          // assuming a symbol sequence "A B C B", if "B C" is merged, reduce the frequency of "C B".
+          // however, skip this if the sequence is A B C B C, because the frequency of "C B" will be reduced by the previous code block
+          if (old_word[i+2] != first || i >= old_word_size-3 || old_word[i+3] != second)
+            add(make_pair_key(old_word[i+1], old_word[i+2]), -1);
         }
-      changes.emplace_back(j, word, std::move(wordcopy), freq);
+        i += 2;
+      }
+      else
+        i += 1;
     }
 
-    return changes;
+    i = 0;
+    while (true) {
+      // find new pair
+      auto it = std::find(word + i, word + word_size, new_pair);
+      if (it == word + word_size)
+        break;
+      i = it - word;
+      // assuming a symbol sequence "A BC D", if "B C" is merged, increase the frequency of "A BC"
+      if (i)
+        add(make_pair_key(word[i-1], word[i]), 1);
+      // assuming a symbol sequence "A BC B", if "B C" is merged, increase the frequency of "BC B"
+      // however, if the sequence is A BC BC, skip this step because the count of "BC BC" will be incremented by the previous code block
+      if (i < word_size-1 && word[i+1] != new_pair)
+        add(make_pair_key(word[i], word[i+1]), 1);
+      i += 1;
+    }
   }
 
-  static void prune_stats(std::unordered_map<const bigram*, int>& stats,
-                          std::unordered_map<const bigram*, int>& big_stats,
-                          float threshold) {
-    /* Prune statistics dict for efficiency of max()
-
-    The frequency of a symbol pair never increases, so pruning is generally safe
-    (until we the most frequent pair is less frequent than a pair we previously pruned)
-    big_stats keeps full statistics for when we need to access pruned items
-    */
-    std::unordered_map<const bigram*, int> pruned_stats;
-    for (auto& stat : stats) {
-      const int freq = stat.second;
-      if (freq < threshold) {
-        const bigram* item = stat.first;
-        if (freq < 0)
-          big_stats[item] += freq;
-        else
-          big_stats[item] = freq;
+  // Replaces all occurrences of (first, second) in the word j by new_pair and calls
+  // add(pair, count) for each pair that is changed. old_word is a scratch buffer.
+  template <typename Add>
+  static void merge_word(WordBuffer& words,
+                         size_t j,
+                         int32_t first,
+                         int32_t second,
+                         int32_t new_pair,
+                         std::vector<int32_t>& old_word,
+                         const Add& add) {
+    int32_t* word = words.symbols.data() + words.offsets[j];
+    const size_t old_word_size = words.lengths[j];
+    old_word.assign(word, word + old_word_size);
+
+    size_t word_size = 0;
+    for (size_t h = 0; h < old_word_size;) {
+      if (h + 1 < old_word_size && old_word[h] == first && old_word[h+1] == second) {
+        word[word_size++] = new_pair;
+        h += 2;
       } else {
-        pruned_stats.emplace(std::move(stat));
+        word[word_size++] = old_word[h++];
       }
     }
-    stats = std::move(pruned_stats);
+
+    if (word_size == old_word_size)  // The word does not contain the pair anymore.
+      return;
+
+    words.lengths[j] = word_size;
+    get_pair_updates(first, second, new_pair,
+                     word, word_size,
+                     old_word.data(), old_word_size,
+                     add);
   }
 
-  static std::vector<std::pair<int, sequence>>
-  get_inv_char_frequency(const std::unordered_map<std::string, int>& vocab) {
-    /* convert vocab into character sequence+</w> and sort by inv frequency */
-    std::multimap<int, sequence> char_vocab;
-    for (const auto& pair : vocab) {
-      const std::string& token = pair.first;
-      const int frequency = pair.second;
-      sequence chars = BPE::get_initial_pieces(unicode::get_characters_info(token));
-      chars.back().append("</w>");
-      char_vocab.emplace(-frequency, std::move(chars));
+  static void
+  merge_pair(symbol_pair pair,
+             SymbolTable& symbols,
+             WordBuffer& words,
+             pair_stats& stats,
+             pair_indices& indices,
+             size_t num_threads) {
+    /* Replace all occurrences of a symbol pair ('A', 'B') with a new symbol 'AB', and
+    minimally update the indices and frequency of symbol pairs
+
+    if we merge a pair of symbols, only pairs that overlap with occurrences
+    of this pair are affected, and need to be updated.
+    */
+    const int32_t first = pair_first(pair);
+    const int32_t second = pair_second(pair);
+    const int32_t new_pair = symbols.intern(symbols[first] + symbols[second]);
+
+    std::vector<int32_t> changed_words;
+    changed_words.swap(indices[pair]);
+    std::sort(changed_words.begin(), changed_words.end());
+    changed_words.erase(std::unique(changed_words.begin(), changed_words.end()),
+                        changed_words.end());
+    stats.set(pair, 0);
+
+    const size_t num_ranges = get_num_ranges(changed_words.size(), num_threads, 256);
+    if (num_ranges == 1) {
+      std::vector<int32_t> old_word;
+      for (const int32_t j : changed_words) {
+        merge_word(words, j, first, second, new_pair, old_word,
+                   [&](symbol_pair updated_pair, int count) {
+                     apply_update(stats, indices, updated_pair, j, count, words.freqs[j]);
+                   });
+      }
+      return;
     }
 
-    std::vector<std::pair<int, sequence>> sorted_vocab;
-    sorted_vocab.reserve(char_vocab.size());
-    for (auto& pair : char_vocab) {
-      const int inv_frequency = pair.first;
-      sequence& chars = pair.second;
-      sorted_vocab.emplace_back(-inv_frequency, std::move(chars));
+    // Each word is updated independently.
+    std::vector<std::vector<PairUpdate>> updates(num_ranges);
+    ThreadPool::get_shared().parallel_for(num_ranges, num_ranges, [&](size_t r) {
+      const auto range = get_range(changed_words.size(), num_ranges, r);
+      std::vector<int32_t> old_word;
+      for (size_t c = range.first; c < range.second; ++c) {
+        const int32_t j = changed_words[c];
+        merge_word(words, j, first, second, new_pair, old_word,
+                   [&](symbol_pair updated_pair, int count) {
+                     updates[r].emplace_back(PairUpdate{updated_pair, j, count});
+                   });
+      }
+    });
+    apply_updates(updates, words, stats, indices);
+  }
+
+  static void
+  get_pair_statistics(const WordBuffer& words,
+                      pair_stats& stats,
+                      pair_indices& indices,
+                      size_t num_threads) {
+    /* Count frequency of all symbol pairs, and create index */
+    const size_t num_ranges = get_num_ranges(words.size(), num_threads, 1024);
+    if (num_ranges == 1) {
+      for (size_t i = 0; i < words.size(); i++) {
+        const int32_t* word = words.begin(i);
+        for (size_t j = 1; j < words.lengths[i]; j++)
+          apply_update(stats, indices, make_pair_key(word[j-1], word[j]), i, 1, words.freqs[i]);
+      }
+      return;
     }
 
-    return sorted_vocab;
+    // Pairs are collected in parallel and counted in order.
+    std::vector<std::vector<PairUpdate>> updates(num_ranges);
+    ThreadPool::get_shared().parallel_for(num_ranges, num_ranges, [&](size_t r) {
+      const auto range = get_range(words.size(), num_ranges, r);
+      for (size_t i = range.first; i < range.second; i++) {
+        const int32_t* word = words.begin(i);
+        for (size_t j = 1; j < words.lengths[i]; j++)
+          updates[r].emplace_back(PairUpdate{make_pair_key(word[j-1], word[j]), int32_t(i), 1});
+      }
+    });
+    apply_updates(updates, words, stats, indices);
   }
 
-  static std::pair<const bigram*, int>
-  get_most_frequent(const std::unordered_map<const bigram*, int>& stats) {
-    // The comparison on the bigram is to have the same priority as previous
-    // versions of this code that iterates on a std::map.
-    return *std::max_element(stats.begin(), stats.end(),
-                             [](const std::pair<const bigram*, int>& a,
-                                const std::pair<const bigram*, int>& b) {
-                               return (a.second < b.second
-                                       || (a.second == b.second && *a.first > *b.first));
-                             });
+  static WordBuffer
+  get_inv_char_frequency(const std::unordered_map<std::string, int>& vocab,
+                         SymbolTable& symbols) {
+    /* convert vocab into character sequence+</w> and sort by inv frequency */
+    std::vector<std::pair<int, const std::string*>> sorted_vocab;
+    sorted_vocab.reserve(vocab.size());
+    for (const auto& pair : vocab)
+      sorted_vocab.emplace_back(pair.second, &pair.first);
+    std::stable_sort(sorted_vocab.begin(), sorted_vocab.end(),
+                     [](const std::pair<int, const std::string*>& a,
+                        const std::pair<int, const std::string*>& b) {
+                       return a.first > b.first;
+                     });
+
+    WordBuffer words;
+    words.offsets.reserve(sorted_vocab.size());
+    words.lengths.reserve(sorted_vocab.size());
+    words.freqs.reserve(sorted_vocab.size());
+    for (const auto& pair : sorted_vocab) {
+      std::vector<std::string> chars = BPE::get_initial_pieces(unicode::get_characters_info(*pair.second));
+      if (chars.empty())
+        continue;
+      chars.back().append("</w>");
+      words.offsets.emplace_back(words.symbols.size());
+      words.lengths.emplace_back(chars.size());
+      words.freqs.emplace_back(pair.first);
+      for (const auto& c : chars)
+        words.symbols.emplace_back(symbols.intern(c));
+    }
+
+    return words;
   }
 
   void BPELearner::learn(std::ostream &os, const char *description, bool verbose) {
@@ -302,26 +608,24 @@ namespace onmt
       os << desc << '\n';
     }
 
-    std::vector<std::pair<int, sequence>> sorted_vocab = get_inv_char_frequency(_vocab);
-    bigram_collection collection;
-    std::unordered_map<const bigram*, int> stats;
-    std::unordered_map<const bigram*, std::unordered_map<int, int>> indices;
-    get_pair_statistics(collection, sorted_vocab, stats, indices);
+    SymbolTable symbols;
+    WordBuffer words = get_inv_char_frequency(_vocab, symbols);
+    pair_stats stats(symbols);
+    pair_indices indices;
+    get_pair_statistics(words, stats, indices, _num_threads);
 
     if (stats.empty())
       throw std::runtime_error("No pairs of characters were found in the ingested data");
 
-    std::unordered_map<const bigram*, int> big_stats(stats);
-
     if (_total_symbols) {
-      std::unordered_set<std::string> uniq_char_internal;
-      std::unordered_set<std::string> uniq_char_final;
-      for(size_t i = 0; i < sorted_vocab.size(); i++) {
-        const sequence &word = sorted_vocab[i].second;
-        for(size_t j = 1; j < word.size(); j++) {
+      std::unordered_set<int32_t> uniq_char_internal;
+      std::unordered_set<int32_t> uniq_char_final;
+      for(size_t i = 0; i < words.size(); i++) {
+        const int32_t* word = words.begin(i);
+        for(size_t j = 1; j < words.lengths[i]; j++) {
           uniq_char_internal.insert(word[j-1]);
         }
-        uniq_char_final.insert(word.back());
+        uniq_char_final.insert(*(words.end(i) - 1));
       }
       std::cerr << "Number of word-internal characters: " << uniq_char_internal.size() << std::endl;
       std::cerr << "Number of word-final characters: " << uniq_char_final.size() << std::endl;
@@ -330,40 +634,27 @@ namespace onmt
       _symbols -= uniq_char_internal.size() + uniq_char_final.size();
     }
 
-    const int max = stats.empty() ? -1: get_most_frequent(stats).second;
-
-    float threshold = max / 10.;
     for(int i = 0; i < _symbols; i++) {
-      const bigram* most_frequent = nullptr;
-      int max_freq = -1;
-      if (!stats.empty())
-        std::tie(most_frequent, max_freq) = get_most_frequent(stats);
-
-      if (stats.empty() || (i && max_freq < threshold)) {
-        prune_stats(stats, big_stats, threshold);
-        stats = big_stats;
-        std::tie(most_frequent, max_freq) = get_most_frequent(stats);
-        // threshold is inspired by Zipfian assumption, but should only affect speed
-        threshold = max_freq * i/(i+10000.0);
-        prune_stats(stats, big_stats, threshold);
-      }
+      symbol_pair most_frequent;
+      int max_freq;
+      std::tie(most_frequent, max_freq) = stats.top();
 
       if (max_freq < _min_frequency) {
         std::cerr << "no pair has frequency >= " << _min_frequency << ". Stopping\n";
         break;
       }
+
+      const std::string& first = symbols[pair_first(most_frequent)];
+      const std::string& second = symbols[pair_second(most_frequent)];
       if (verbose)
-        std::cerr << "pair " << i << ": " << most_frequent->first << " " << most_frequent->second <<
-                     " -> " << most_frequent->first << most_frequent->second <<
+        std::cerr << "pair " << i << ": " << first << " " << second <<
+                     " -> " << first << second <<
                      " (frequency " << max_freq << ")\n";
       
-      os << most_frequent->first << ' ' << most_frequent->second << '\n';
+      os << first << ' ' << second << '\n';
 
-      const std::vector<Change> changes = replace_pair(most_frequent, sorted_vocab, indices);
-      update_pair_statistics(collection, most_frequent, changes, stats, indices);
-      stats[most_frequent] = 0;
-      if (i % 100 == 0)
-        prune_stats(stats, big_stats, threshold);
+      merge_pair(most_frequent, symbols, words, stats, indices, _num_threads);
+      stats.set(most_frequent, 0);
     }
 
     os.flush();
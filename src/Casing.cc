@@ -2,8 +2,11 @@
 
 #include <algorithm>
 
+#include <unicode/utf8.h>
 #include <unicode/uvernum.h>
 #if U_ICU_VERSION_MAJOR_NUM >= 60
+#  include <unicode/bytestream.h>
+#  include <unicode/casemap.h>
 #  include <unicode/locid.h>
 #  include <unicode/unistr.h>
 #  include <unicode/stringoptions.h>
@@ -69,86 +72,230 @@ namespace onmt
   }
 
 
-  std::pair<std::string, Casing> lowercase_token(const std::string& token, const std::string& lang)
+  // Calls function(data, length, value, is_letter, case_type) for each character of token,
+  // with the same iteration as unicode::get_characters_info but without building the
+  // vector. ASCII characters are classified without table lookups. Returns false if
+  // invalid characters were skipped.
+  template <typename Function>
+  static inline bool for_each_char(const std::string& token, const Function& function)
+  {
+    bool valid = true;
+    const char* data = token.c_str();
+    const char* end = data + token.size();
+    while (data < end)
+    {
+      const auto lead = static_cast<unsigned char>(*data);
+      if (lead < 0x80)
+      {
+        if (lead == 0)
+          return false;
+        if (lead >= 'a' && lead <= 'z')
+          function(data, 1, lead, true, unicode::CaseType::Lower);
+        else if (lead >= 'A' && lead <= 'Z')
+          function(data, 1, lead, true, unicode::CaseType::Upper);
+        else
+          function(data, 1, lead, false, unicode::CaseType::None);
+        data += 1;
+        continue;
+      }
+
+      size_t length = 0;
+      const unicode::code_point_t value = unicode::utf8_to_cp(data, &length);
+      if (value == 0)  // Ignore invalid code points.
+      {
+        valid = false;
+        data++;
+        continue;
+      }
+
+      function(data,
+               length,
+               value,
+               unicode::get_char_type(value) == unicode::CharType::Letter,
+               unicode::get_case_v2(value));
+      data += length;
+    }
+
+    return valid;
+  }
+
+  static inline size_t encode_char(unicode::code_point_t value, char* buffer)
+  {
+    if (value < 0x80)
+    {
+      buffer[0] = static_cast<char>(value);
+      return 1;
+    }
+    int32_t length = 0;
+    UBool error = false;
+    U8_APPEND(reinterpret_cast<uint8_t*>(buffer), length, 4, value, error);
+    return error ? 0 : length;
+  }
+
+  static inline void append_char(unicode::code_point_t value, std::string& output)
+  {
+    char buffer[4];
+    output.append(buffer, encode_char(value, buffer));
+  }
+
+  size_t lowercase_char(unicode::code_point_t value, char* buffer)
+  {
+    if (value >= 'A' && value <= 'Z')
+    {
+      buffer[0] = static_cast<char>(value + ('a' - 'A'));
+      return 1;
+    }
+    return encode_char(unicode::get_lower(value), buffer);
+  }
+
+  static inline void append_uppercase_char(unicode::code_point_t value, std::string& output)
+  {
+    if (value >= 'a' && value <= 'z')
+      output += static_cast<char>(value - ('a' - 'A'));
+    else
+      append_char(unicode::get_upper(value), output);
+  }
+
+#if U_ICU_VERSION_MAJOR_NUM >= 60
+  // Building an ICU locale is costly: the locale of the last language is cached in each thread.
+  static const icu::Locale& get_locale(const std::string& lang)
+  {
+    static thread_local std::string cached_lang;
+    static thread_local icu::Locale cached_locale;
+    if (lang != cached_lang)
+    {
+      cached_locale = icu::Locale(lang.c_str());
+      cached_lang = lang;
+    }
+    return cached_locale;
+  }
+#endif
+
+  static Casing get_token_casing(const std::string& token, bool* valid)
   {
-    Casing current_casing = Casing::None;
+    Casing casing = Casing::None;
     size_t letter_index = 0;
-    std::string new_token;
+    const bool valid_chars = for_each_char(token, [&](const char*,
+                                                      size_t,
+                                                      unicode::code_point_t,
+                                                      bool is_letter,
+                                                      unicode::CaseType case_type) {
+      if (is_letter)
+        casing = update_casing(casing, case_type, letter_index++);
+    });
+    if (valid)
+      *valid = valid_chars;
+    return casing;
+  }
 
+  Casing get_token_casing(const std::string& token)
+  {
+    return get_token_casing(token, nullptr);
+  }
+
+  Casing lowercase_token(const std::string& token, const std::string& lang, std::string& output)
+  {
 #if U_ICU_VERSION_MAJOR_NUM >= 60
     if (!lang.empty())
     {
-      // First resolve the casing of the token.
-      for (const auto& c : unicode::get_characters_info(token))
+      // First resolve the casing of the token, then apply language specific lowercasing
+      // with ICU. The UTF-8 case mapping keeps invalid bytes, so tokens with invalid
+      // characters are converted to a UnicodeString, which replaces them.
+      bool valid = true;
+      const Casing casing = get_token_casing(token, &valid);
+      if (!valid)
       {
-        if (c.char_type == unicode::CharType::Letter)
-          current_casing = update_casing(current_casing, c.case_type, letter_index++);
+        icu::UnicodeString::fromUTF8(token).toLower(get_locale(lang)).toUTF8String(output);
+        return casing;
       }
 
-      // Then apply language specific lowercasing with ICU.
-      icu::Locale locale(lang.c_str());
-      icu::UnicodeString::fromUTF8(token).toLower(locale).toUTF8String(new_token);
-      return std::make_pair(std::move(new_token), std::move(current_casing));
+      UErrorCode status = U_ZERO_ERROR;
+      icu::StringByteSink<std::string> sink(&output, static_cast<int32_t>(token.size()));
+      icu::CaseMap::utf8ToLower(get_locale(lang).getName(),
+                                0,
+                                icu::StringPiece(token.data(), static_cast<int32_t>(token.size())),
+                                sink,
+                                nullptr,
+                                status);
+      return casing;
     }
 #else
     (void)lang;
 #endif
 
-    new_token.reserve(token.size());
-
-    for (const auto& c : unicode::get_characters_info(token))
-    {
-      if (c.char_type == unicode::CharType::Letter)
+    Casing casing = Casing::None;
+    size_t letter_index = 0;
+    output.reserve(output.size() + token.size());
+    for_each_char(token, [&](const char* data, size_t length, unicode::code_point_t value,
+                             bool is_letter, unicode::CaseType case_type) {
+      if (is_letter)
       {
-        current_casing = update_casing(current_casing, c.case_type, letter_index++);
-        if (c.case_type == unicode::CaseType::Upper)
-          new_token.append(unicode::cp_to_utf8(unicode::get_lower(c.value)));
-        else
-          new_token.append(c.data, c.length);
+        casing = update_casing(casing, case_type, letter_index++);
+        if (case_type == unicode::CaseType::Upper)
+        {
+          char buffer[4];
+          output.append(buffer, lowercase_char(value, buffer));
+          return;
+        }
       }
-      else
-        new_token.append(c.data, c.length);
-    }
+      output.append(data, length);
+    });
+    return casing;
+  }
 
-    return std::make_pair(std::move(new_token), std::move(current_casing));
+  std::pair<std::string, Casing> lowercase_token(const std::string& token, const std::string& lang)
+  {
+    std::string new_token;
+    const Casing casing = lowercase_token(token, lang, new_token);
+    return std::make_pair(std::move(new_token), casing);
   }
 
-  std::string restore_token_casing(const std::string& token, Casing casing, const std::string& lang)
+  void restore_token_casing(const std::string& token,
+                            Casing casing,
+                            const std::string& lang,
+                            std::string& output)
   {
     if (token.empty() || casing == Casing::Lowercase || casing == Casing::None)
-      return token;
+    {
+      output += token;
+      return;
+    }
     if (casing == Casing::Mixed)
       throw std::invalid_argument("Can't restore mixed casing");
 
-    std::string new_token;
-
 #if U_ICU_VERSION_MAJOR_NUM >= 60
     if (!lang.empty())
     {
       // Apply language specific recasing with ICU.
-      icu::Locale locale(lang.c_str());
+      const icu::Locale& locale = get_locale(lang);
       auto utoken = icu::UnicodeString::fromUTF8(token);
       if (casing == Casing::Capitalized)
         utoken.toTitle(nullptr, locale, U_TITLECASE_WHOLE_STRING);
       else
         utoken.toUpper(locale);
-      utoken.toUTF8String(new_token);
-      return new_token;
+      utoken.toUTF8String(output);
+      return;
     }
 #else
     (void)lang;
 #endif
 
-    new_token.reserve(token.size());
-
-    for (const auto& c : unicode::get_characters_info(token))
-    {
-      if (new_token.empty() || casing == Casing::Uppercase)
-        new_token.append(unicode::cp_to_utf8(unicode::get_upper(c.value)));
+    output.reserve(output.size() + token.size());
+    bool first = true;
+    for_each_char(token, [&](const char* data, size_t length, unicode::code_point_t value,
+                             bool, unicode::CaseType) {
+      if (first || casing == Casing::Uppercase)
+        append_uppercase_char(value, output);
       else
-        new_token.append(c.data, c.length);
-    }
+        output.append(data, length);
+      first = false;
+    });
+  }
 
+  std::string restore_token_casing(const std::string& token, Casing casing, const std::string& lang)
+  {
+    std::string new_token;
+    restore_token_casing(token, casing, lang, new_token);
     return new_token;
   }
 
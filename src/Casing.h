@@ -16,6 +16,20 @@ namespace onmt
                                    Casing casing,
                                    const std::string& lang = "");
 
+  // Same as above but the result is appended to output, so that its memory can be reused.
+  Casing lowercase_token(const std::string& token, const std::string& lang, std::string& output);
+  void restore_token_casing(const std::string& token,
+                            Casing casing,
+                            const std::string& lang,
+                            std::string& output);
+
+  // Returns the casing of token without lowercasing it.
+  Casing get_token_casing(const std::string& token);
+
+  // Writes the UTF-8 encoding of the lowercase character in buffer, which should have
+  // at least 4 bytes, and returns its length.
+  size_t lowercase_char(unicode::code_point_t value, char* buffer);
+
   char casing_to_char(Casing type);
   Casing char_to_casing(char feature);
 
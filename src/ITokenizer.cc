@@ -1,11 +1,15 @@
 #include "onmt/ITokenizer.h"
 
-#include <future>
+#include <algorithm>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <fstream>
+#include <memory>
 #include <mutex>
-#include <queue>
-#include <sstream>
 #include <thread>
 
+#include "MappedFile.h"
 #include "Utils.h"
 
 namespace onmt
@@ -14,33 +18,162 @@ namespace onmt
   const std::string ITokenizer::feature_marker("￨");
 
 
-  template <typename Output, typename Function>
-  void work_loop(const Function& function,
-                 std::queue<std::pair<std::promise<Output>, std::string>>& queue,
-                 std::mutex& mutex,
-                 std::condition_variable& cv,
-                 const bool& end_requested)
+  // Batch of lines that is processed by a single worker. Batches are reused so that
+  // their buffers are only allocated in the first iterations.
+  struct LineBatch
   {
-    while (true)
+    std::string input;  // Storage of the lines when they are not views on a mapped file.
+    std::vector<std::string_view> lines;
+    std::string output;
+    std::exception_ptr exception;
+    bool done = false;
+  };
+
+  // Reads lines from a stream in large blocks. Only the data that is already available is
+  // read, so that a batch is returned as soon as the stream has no complete line to give
+  // (e.g. an interactive terminal) instead of blocking until the block is full.
+  class StreamLineReader
+  {
+  public:
+    StreamLineReader(std::istream& in, size_t block_size = 1 << 16)
+      : _in(in)
+      , _buffer(block_size, '\0')
+    {
+    }
+
+    // Replaces the lines of the batch by the next lines (at most max_lines), excluding
+    // the newline characters. The batch can contain fewer lines when no more input is
+    // available yet. Returns false at the end of the stream.
+    bool read(LineBatch& batch, size_t max_lines)
     {
-      std::unique_lock<std::mutex> lock(mutex);
-      cv.wait(lock, [&queue, &end_requested]{
-        return !queue.empty() || end_requested;
-      });
+      std::string& data = batch.input;
+      data.clear();
+      _ranges.clear();
 
-      if (end_requested)
+      while (_ranges.size() < max_lines)
       {
-        lock.unlock();
-        break;
+        const char* begin = _buffer.data() + _begin;
+        const char* newline = static_cast<const char*>(std::memchr(begin, '\n', _end - _begin));
+
+        if (!newline)
+        {
+          // Only block for input when the batch is still empty.
+          if (fill(/*blocking=*/_ranges.empty()))
+            continue;
+          if (!_ranges.empty() || _begin == _end)
+            break;
+          begin = _buffer.data() + _begin;  // The buffer may have been moved by fill.
+          newline = _buffer.data() + _end;  // Last line without newline.
+        }
+
+        const size_t length = newline - begin;
+        _ranges.emplace_back(data.size(), length);
+        data.append(begin, length);
+        _begin = std::min(_begin + length + 1, _end);
+      }
+
+      batch.lines.clear();
+      for (const auto& range : _ranges)
+        batch.lines.emplace_back(data.data() + range.first, range.second);
+      return !batch.lines.empty();
+    }
+
+  private:
+    std::istream& _in;
+    std::string _buffer;
+    size_t _begin = 0;
+    size_t _end = 0;
+    std::vector<std::pair<size_t, size_t>> _ranges;
+    std::string _line;
+
+    // Reads the available data after the incomplete line. If nothing is available and
+    // blocking is set, waits for the next line. Returns false if nothing was read.
+    bool fill(bool blocking)
+    {
+      if (!_in)
+        return false;
+
+      if (_begin > 0)
+      {
+        std::memmove(&_buffer[0], _buffer.data() + _begin, _end - _begin);
+        _end -= _begin;
+        _begin = 0;
+      }
+
+      if (_end == _buffer.size())  // The line is longer than the buffer.
+        _buffer.resize(_buffer.size() * 2);
+
+      size_t num_read = _in.readsome(&_buffer[_end], _buffer.size() - _end);
+
+      if (num_read == 0 && blocking && _in)
+      {
+        // Streams that can not report the available data also end up here.
+        if (!std::getline(_in, _line))
+          return false;
+        if (!_in.eof())
+          _line += '\n';
+        if (_buffer.size() - _end < _line.size())
+          _buffer.resize(_end + _line.size());
+        _line.copy(&_buffer[_end], _line.size());
+        num_read = _line.size();
+      }
+
+      _end += num_read;
+      return num_read > 0;
+    }
+  };
+
+  // Reads lines from a memory mapped file. The lines are views on the mapping.
+  class MappedLineReader
+  {
+  public:
+    MappedLineReader(const MappedFile& file)
+      : _position(file.data())
+      , _end(file.data() + file.size())
+    {
+    }
+
+    bool read(LineBatch& batch, size_t max_lines)
+    {
+      batch.lines.clear();
+
+      while (batch.lines.size() < max_lines && _position != _end)
+      {
+        const char* newline = static_cast<const char*>(std::memchr(_position,
+                                                                   '\n',
+                                                                   _end - _position));
+        if (!newline)
+          newline = _end;
+        batch.lines.emplace_back(_position, newline - _position);
+        _position = newline == _end ? _end : newline + 1;
       }
 
-      auto work = std::move(queue.front());
-      queue.pop();
-      lock.unlock();
+      return !batch.lines.empty();
+    }
+
+  private:
+    const char* _position;
+    const char* _end;
+  };
+
+  // function(line, output) appends the result of each line to the batch output.
+  template <typename Function>
+  void process_batch(const Function& function, LineBatch& batch, std::string& line)
+  {
+    batch.output.clear();
 
-      auto& promise = work.first;
-      auto& text = work.second;
-      promise.set_value(function(text));
+    try
+    {
+      for (const auto line_view : batch.lines)
+      {
+        line.assign(line_view.data(), line_view.size());
+        function(line, batch.output);
+        batch.output += '\n';
+      }
+    }
+    catch (...)
+    {
+      batch.exception = std::current_exception();
     }
   }
 
@@ -48,90 +181,141 @@ namespace onmt
     std::cerr << "... processed " << num_processed << " lines" << std::endl;
   }
 
-  template <typename Output, typename Function, typename Writer>
-  void process_stream(const Function& function,
-                      const Writer& writer,
-                      std::istream& in,
-                      std::ostream& out,
-                      size_t num_threads,
-                      size_t buffer_size,
-                      size_t report_every = 0)
+  // Lines are grouped in batches of batch_size lines. The batches are stored in a ring
+  // that is filled by the calling thread, processed by the workers, and written in order
+  // by the calling thread. The lock is only taken a few times per batch.
+  template <typename Function, typename Reader>
+  void process_lines(const Function& function,
+                     Reader& reader,
+                     std::ostream& out,
+                     size_t num_threads,
+                     size_t batch_size,
+                     size_t report_every = 0)
   {
-    std::string line;
     size_t num_processed = 0;
+    batch_size = std::max(batch_size, size_t(1));
+
+    auto write_batch = [&](LineBatch& batch) {
+      if (batch.exception)
+        std::rethrow_exception(batch.exception);
+      out.write(batch.output.data(), batch.output.size());
+      const size_t num_lines = batch.lines.size();
+      if (report_every > 0 && (num_processed % report_every) + num_lines >= report_every)
+        log_progress((num_processed + num_lines) / report_every * report_every);
+      num_processed += num_lines;
+    };
+
     if (num_threads <= 1) // Fast path for sequential processing.
     {
-      while (std::getline(in, line))
+      LineBatch batch;
+      std::string line;
+      while (reader.read(batch, batch_size))
       {
-        writer(out, function(line));
-        out << '\n';
-        num_processed++;
-        if (report_every > 0 && num_processed % report_every == 0)
-          log_progress(num_processed);
+        process_batch(function, batch, line);
+        write_batch(batch);
+        out.flush();  // The reader may now block waiting for more input.
       }
-      out.flush();
       if (report_every > 0)
         log_progress(num_processed);
       return;
     }
 
-    std::queue<std::pair<std::promise<Output>, std::string>> queue;
+    // Enough batches to keep all workers busy while the next batch is written.
+    std::vector<LineBatch> batches(num_threads * 2);
+    size_t num_read = 0;     // Batches filled by the reader.
+    size_t num_claimed = 0;  // Batches claimed by a worker.
+    size_t num_written = 0;  // Batches written to the output.
+    bool end_requested = false;
+
     std::mutex mutex;
-    std::condition_variable cv;
-    bool request_end = false;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+
+    auto work_loop = [&]() {
+      std::string line;
+      while (true)
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        work_cv.wait(lock, [&]{ return num_claimed < num_read || end_requested; });
+        if (num_claimed == num_read)  // End requested.
+          break;
+
+        LineBatch& batch = batches[num_claimed++ % batches.size()];
+        lock.unlock();
+
+        process_batch(function, batch, line);
+
+        lock.lock();
+        batch.done = true;
+        lock.unlock();
+        done_cv.notify_one();
+      }
+    };
 
     std::vector<std::thread> workers;
     workers.reserve(num_threads);
     for (size_t i = 0; i < num_threads; ++i)
-      workers.emplace_back(&work_loop<Output, Function>,
-                           std::cref(function),
-                           std::ref(queue),
-                           std::ref(mutex),
-                           std::ref(cv),
-                           std::cref(request_end));
-
-    std::queue<std::future<Output>> futures;
-
-    auto pop_results = [&writer, &futures, &out, &num_processed, report_every](bool blocking) {
-      static const auto zero_sec = std::chrono::seconds(0);
-      while (!futures.empty()
-             && (blocking
-                 || futures.front().wait_for(zero_sec) == std::future_status::ready)) {
-        writer(out, futures.front().get());
-        out << '\n';
-        futures.pop();
-        num_processed++;
-        if (report_every > 0 && num_processed % report_every == 0)
-          log_progress(num_processed);
+      workers.emplace_back(work_loop);
+
+    auto stop_workers = [&]() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        end_requested = true;
       }
+      work_cv.notify_all();
+      for (auto& worker : workers)
+        worker.join();
     };
 
-    while (std::getline(in, line))
-    {
+    // Writes the processed batches in order. With blocking, waits for the next batch.
+    auto pop_batches = [&](bool blocking) {
+      while (num_written < num_read)
       {
-        std::lock_guard<std::mutex> lock(mutex);
-        queue.emplace(std::piecewise_construct,
-                      std::forward_as_tuple(),
-                      std::forward_as_tuple(std::move(line)));
-        futures.emplace(queue.back().first.get_future());
+        LineBatch& batch = batches[num_written % batches.size()];
+        {
+          std::unique_lock<std::mutex> lock(mutex);
+          if (blocking)
+            done_cv.wait(lock, [&batch]{ return batch.done; });
+          else if (!batch.done)
+            break;
+          batch.done = false;
+        }
+
+        write_batch(batch);
+        ++num_written;
+        blocking = false;
       }
+    };
 
-      cv.notify_one();
-      if (futures.size() >= buffer_size)
-        pop_results(/*blocking=*/false);
-    }
+    try
+    {
+      while (true)
+      {
+        if (num_read - num_written == batches.size())
+          pop_batches(/*blocking=*/true);
+
+        LineBatch& batch = batches[num_read % batches.size()];
+        if (!reader.read(batch, batch_size))
+          break;
 
-    if (!futures.empty())
-      pop_results(/*blocking=*/true);
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          ++num_read;
+        }
+        work_cv.notify_one();
+        pop_batches(/*blocking=*/false);
+      }
 
+      while (num_written < num_read)
+        pop_batches(/*blocking=*/true);
+    }
+    catch (...)
     {
-      std::lock_guard<std::mutex> lock(mutex);
-      request_end = true;
+      stop_workers();
+      throw;
     }
 
-    cv.notify_all();
-    for (auto& worker : workers)
-      worker.join();
+    stop_workers();
     out.flush();
     if (report_every > 0)
       log_progress(num_processed);
@@ -155,6 +339,36 @@ namespace onmt
     tokenize(text, words, features, training);
   }
 
+  static void append_tokens(const std::vector<std::string>& tokens,
+                            const std::vector<std::vector<std::string>>& features,
+                            std::string& output,
+                            const std::string& tokens_delimiter)
+  {
+    for (size_t i = 0; i < tokens.size(); ++i)
+    {
+      if (i > 0)
+        output += tokens_delimiter;
+      output += tokens[i];
+
+      for (size_t j = 0; j < features.size(); ++j)
+      {
+        output += ITokenizer::feature_marker;
+        output += features[j][i];
+      }
+    }
+  }
+
+  void ITokenizer::tokenize_and_write(const std::string& text,
+                                      std::string& output,
+                                      const std::string& tokens_delimiter,
+                                      bool training) const
+  {
+    std::vector<std::string> words;
+    std::vector<std::vector<std::string>> features;
+    tokenize(text, words, features, training);
+    append_tokens(words, features, output, tokens_delimiter);
+  }
+
   std::string ITokenizer::detokenize(const std::vector<std::string>& words) const
   {
     std::vector<std::vector<std::string> > features;
@@ -175,6 +389,31 @@ namespace onmt
     return detokenize(words, features);
   }
 
+  template <typename Reader>
+  static void tokenize_lines(const ITokenizer& tokenizer,
+                             Reader& reader,
+                             std::ostream& out,
+                             size_t num_threads,
+                             bool verbose,
+                             bool training,
+                             const std::string& tokens_delimiter,
+                             size_t buffer_size)
+  {
+    auto function = [&tokenizer, &tokens_delimiter, training](const std::string& text,
+                                                               std::string& output)
+                    {
+                      tokenizer.tokenize_and_write(text, output, tokens_delimiter, training);
+                    };
+    if (verbose)
+      std::cerr << "Start processing..." << std::endl;
+    process_lines(function,
+                  reader,
+                  out,
+                  num_threads,
+                  buffer_size,
+                  verbose ? 100000 : 0);
+  }
+
   void ITokenizer::tokenize_stream(std::istream& in,
                                    std::ostream& out,
                                    size_t num_threads,
@@ -183,43 +422,108 @@ namespace onmt
                                    const std::string& tokens_delimiter,
                                    size_t buffer_size) const
   {
-    using Result = std::pair<std::vector<std::string>, std::vector<std::vector<std::string>>>;
-    auto function = [this, training](const std::string& text)
-                    {
-                      std::vector<std::string> words;
-                      std::vector<std::vector<std::string>> features;
-                      this->tokenize(text, words, features, training);
-                      return Result(std::move(words), std::move(features));
-                    };
-    auto writer = [&tokens_delimiter](std::ostream& os, const Result& result)
-                  {
-                    const auto& words = result.first;
-                    const auto& features = result.second;
-                    write_tokens(words, features, os, tokens_delimiter);
-                  };
-    if (verbose)
-      std::cerr << "Start processing..." << std::endl;
-    process_stream<Result>(function,
-                           writer,
-                           in,
-                           out,
-                           num_threads,
-                           buffer_size,
-                           verbose ? 100000 : 0);
+    StreamLineReader reader(in);
+    tokenize_lines(*this, reader, out, num_threads, verbose, training, tokens_delimiter, buffer_size);
   }
 
-  void ITokenizer::detokenize_stream(std::istream& in,
-                                     std::ostream& out,
-                                     const std::string& tokens_delimiter) const
+  void ITokenizer::tokenize_file(const std::string& input_path,
+                                 std::ostream& out,
+                                 size_t num_threads,
+                                 bool verbose,
+                                 bool training,
+                                 const std::string& tokens_delimiter,
+                                 size_t buffer_size) const
+  {
+    std::unique_ptr<MappedFile> input;
+    try
+    {
+      input = std::make_unique<MappedFile>(input_path);
+    }
+    catch (const std::runtime_error&)
+    {
+      // The file can not be mapped (e.g. a pipe): read it as a stream.
+      std::ifstream in(input_path);
+      if (!in)
+        throw std::invalid_argument("Failed to open input file " + input_path);
+      tokenize_stream(in, out, num_threads, verbose, training, tokens_delimiter, buffer_size);
+      return;
+    }
+
+    MappedLineReader reader(*input);
+    tokenize_lines(*this, reader, out, num_threads, verbose, training, tokens_delimiter, buffer_size);
+  }
+
+  void ITokenizer::tokenize_file(const std::string& input_path,
+                                 const std::string& output_path,
+                                 size_t num_threads,
+                                 bool verbose,
+                                 bool training,
+                                 const std::string& tokens_delimiter,
+                                 size_t buffer_size) const
+  {
+    if (!std::ifstream(input_path))  // Do not create the output file in this case.
+      throw std::invalid_argument("Failed to open input file " + input_path);
+    std::ofstream out(output_path);
+    if (!out)
+      throw std::invalid_argument("Failed to open output file " + output_path);
+    tokenize_file(input_path, out, num_threads, verbose, training, tokens_delimiter, buffer_size);
+  }
+
+  template <typename Reader>
+  static void detokenize_lines(const ITokenizer& tokenizer,
+                               Reader& reader,
+                               std::ostream& out,
+                               const std::string& tokens_delimiter,
+                               size_t num_threads,
+                               size_t buffer_size)
   {
-    auto function = [this, &tokens_delimiter](const std::string& line) {
+    auto function = [&tokenizer, &tokens_delimiter](const std::string& line,
+                                                    std::string& output) {
       std::vector<std::string> tokens;
       std::vector<std::vector<std::string>> features;
       read_tokens(line, tokens, features, tokens_delimiter);
-      return this->detokenize(tokens, features);
+      output += tokenizer.detokenize(tokens, features);
     };
-    auto writer = [](std::ostream& os, const std::string& text) { os << text; };
-    process_stream<std::string>(function, writer, in, out, /*num_threads=*/1, /*buffer_size=*/0);
+    process_lines(function, reader, out, num_threads, buffer_size);
+  }
+
+  void ITokenizer::detokenize_stream(std::istream& in,
+                                     std::ostream& out,
+                                     const std::string& tokens_delimiter,
+                                     size_t num_threads,
+                                     size_t buffer_size) const
+  {
+    StreamLineReader reader(in);
+    detokenize_lines(*this, reader, out, tokens_delimiter, num_threads, buffer_size);
+  }
+
+  void ITokenizer::detokenize_file(const std::string& input_path,
+                                   const std::string& output_path,
+                                   const std::string& tokens_delimiter,
+                                   size_t num_threads,
+                                   size_t buffer_size) const
+  {
+    if (!std::ifstream(input_path))  // Do not create the output file in this case.
+      throw std::invalid_argument("Failed to open input file " + input_path);
+    std::ofstream out(output_path);
+    if (!out)
+      throw std::invalid_argument("Failed to open output file " + output_path);
+
+    std::unique_ptr<MappedFile> input;
+    try
+    {
+      input = std::make_unique<MappedFile>(input_path);
+    }
+    catch (const std::runtime_error&)
+    {
+      // The file can not be mapped (e.g. a pipe): read it as a stream.
+      std::ifstream in(input_path);
+      detokenize_stream(in, out, tokens_delimiter, num_threads, buffer_size);
+      return;
+    }
+
+    MappedLineReader reader(*input);
+    detokenize_lines(*this, reader, out, tokens_delimiter, num_threads, buffer_size);
   }
 
   void read_tokens(const std::string& line,
@@ -298,9 +602,9 @@ namespace onmt
                            const std::vector<std::vector<std::string>>& features,
                            const std::string& tokens_delimiter)
   {
-    std::ostringstream oss;
-    write_tokens(tokens, features, oss, tokens_delimiter);
-    return oss.str();
+    std::string output;
+    append_tokens(tokens, features, output, tokens_delimiter);
+    return output;
   }
 
 }
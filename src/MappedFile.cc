@@ -0,0 +1,111 @@
+#include "MappedFile.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#  define NOMINMAX
+#  include <windows.h>
+#else
+#  include <fcntl.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+namespace onmt
+{
+
+#ifdef _WIN32
+
+  MappedFile::MappedFile(const std::string& path)
+    : _data(nullptr)
+    , _size(0)
+    , _file(INVALID_HANDLE_VALUE)
+    , _mapping(nullptr)
+  {
+    _file = CreateFileA(path.c_str(),
+                        GENERIC_READ,
+                        FILE_SHARE_READ,
+                        nullptr,
+                        OPEN_EXISTING,
+                        FILE_ATTRIBUTE_NORMAL,
+                        nullptr);
+    if (_file == INVALID_HANDLE_VALUE)
+      throw std::invalid_argument("Unable to open file " + path);
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(_file, &size))
+    {
+      CloseHandle(_file);
+      throw std::runtime_error("Unable to get the size of file " + path);
+    }
+    _size = static_cast<size_t>(size.QuadPart);
+    if (_size == 0)
+      return;
+
+    _mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (_mapping)
+      _data = static_cast<const char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+    if (!_data)
+    {
+      if (_mapping)
+        CloseHandle(_mapping);
+      CloseHandle(_file);
+      throw std::runtime_error("Unable to map file " + path);
+    }
+  }
+
+  MappedFile::~MappedFile()
+  {
+    if (_data)
+      UnmapViewOfFile(_data);
+    if (_mapping)
+      CloseHandle(_mapping);
+    if (_file != INVALID_HANDLE_VALUE)
+      CloseHandle(_file);
+  }
+
+#else
+
+  MappedFile::MappedFile(const std::string& path)
+    : _data(nullptr)
+    , _size(0)
+  {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::invalid_argument("Unable to open file " + path);
+
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+      close(fd);
+      throw std::runtime_error("Unable to get the size of file " + path);
+    }
+    if (!S_ISREG(st.st_mode))
+    {
+      close(fd);
+      throw std::runtime_error("Unable to map file " + path + ": not a regular file");
+    }
+    _size = static_cast<size_t>(st.st_size);
+    if (_size == 0)
+    {
+      close(fd);
+      return;
+    }
+
+    void* data = mmap(nullptr, _size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+      throw std::runtime_error("Unable to map file " + path);
+    _data = static_cast<const char*>(data);
+  }
+
+  MappedFile::~MappedFile()
+  {
+    if (_data)
+      munmap(const_cast<char*>(_data), _size);
+  }
+
+#endif
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+
+namespace onmt
+{
+
+  // Read-only memory mapping of a whole file. The pages are shared between all
+  // processes mapping the same file.
+  class MappedFile
+  {
+  public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const
+    {
+      return _data;
+    }
+
+    size_t size() const
+    {
+      return _size;
+    }
+
+  private:
+    const char* _data;
+    size_t _size;
+#ifdef _WIN32
+    void* _file;
+    void* _mapping;
+#endif
+  };
+
+}
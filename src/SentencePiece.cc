@@ -62,11 +62,13 @@ namespace onmt
     auto status = _processor->SetVocabulary(vocabulary_views);
     if (!status.ok())
       throw std::invalid_argument(status.ToString());
+    clear_cache();
   }
 
   void SentencePiece::reset_vocabulary()
   {
     _processor->ResetVocabulary();
+    clear_cache();
   }
 
   void SentencePiece::enable_regularization(int nbest_size, float alpha)
@@ -87,9 +89,14 @@ namespace onmt
     return pieces;
   }
 
+  bool SentencePiece::is_sampling(bool training) const
+  {
+    return training && _nbest_size != 0;
+  }
+
   std::vector<Token> SentencePiece::encode_and_annotate(const Token& token, bool training) const
   {
-    std::vector<std::string> pieces = encode(token.surface, training);
+    std::vector<std::string> pieces = encode_with_cache(token.surface, training);
 
     // SentencePiece sometimes returns no pieces for a non empty input. In this case
     // we simply return the original token.
@@ -1,20 +1,113 @@
 #include "onmt/SentencePieceLearner.h"
 
+#include <algorithm>
+#include <fstream>
+
 #include <sentencepiece_trainer.h>
 
+#include "ThreadPool.h"
+
 namespace onmt
 {
 
+  namespace
+  {
+    void format_sentence(const std::string& sentence, std::string& value)
+    {
+      value = sentence;
+    }
+
+    // Deduplicated sentences are passed in the TSV format with their frequency.
+    void format_sentence(const std::pair<const std::string, int64_t>* sentence,
+                         std::string& value)
+    {
+      value = sentence->first;
+      value += '\t';
+      value += std::to_string(sentence->second);
+    }
+
+    // Feeds the ingested sentences to the trainer without a temporary file.
+    template <typename Sentences>
+    class SentenceIterator : public sentencepiece::SentenceIterator
+    {
+    public:
+      SentenceIterator(const Sentences& sentences)
+        : _sentences(sentences)
+      {
+        update_value();
+      }
+
+      bool done() const override
+      {
+        return _index >= _sentences.size();
+      }
+
+      void Next() override
+      {
+        ++_index;
+        update_value();
+      }
+
+      const std::string& value() const override
+      {
+        return _value;
+      }
+
+      sentencepiece::util::Status status() const override
+      {
+        return sentencepiece::util::OkStatus();
+      }
+
+    private:
+      const Sentences& _sentences;
+      size_t _index = 0;
+      std::string _value;
+
+      void update_value()
+      {
+        if (!done())
+          format_sentence(_sentences[_index], _value);
+      }
+    };
+
+    template <typename Sentences>
+    void save_sentences(const Sentences& sentences, const std::string& path)
+    {
+      std::ofstream input(path);
+      std::string value;
+      for (const auto& sentence : sentences)
+      {
+        format_sentence(sentence, value);
+        input << value << '\n';
+      }
+    }
+
+    // The unigram model seeds its pieces from the unique sentences, so only the other
+    // model types produce the same model when the sentences are weighted by their frequency.
+    bool can_deduplicate(const std::string& args)
+    {
+      static const std::string key = "--model_type=";
+      const size_t position = args.rfind(key);
+      if (position == std::string::npos)
+        return false;  // The default model type is unigram.
+      const size_t begin = position + key.size();
+      const std::string model_type = args.substr(begin, args.find(' ', begin) - begin);
+      return model_type == "bpe" || model_type == "char" || model_type == "word";
+    }
+  }
+
   SentencePieceLearner::SentencePieceLearner(bool verbose,
                                              const std::string& opts,
                                              const std::string& input_filename,
                                              bool keep_vocab,
-                                             bool keep_input_file)
-    : SubwordLearner(verbose)
+                                             bool keep_input_file,
+                                             size_t num_threads)
+    : SubwordLearner(verbose, nullptr, num_threads)
     , _args(opts)
     , _input_filename(input_filename)
     , _keep_vocab(keep_vocab)
     , _keep_input_file(keep_input_file)
+    , _deduplicate(can_deduplicate(_args))
   {
   }
 
@@ -22,98 +115,185 @@ namespace onmt
                                              const std::vector<std::string>& opts,
                                              const std::string& input_filename,
                                              bool keep_vocab,
-                                             bool keep_input_file)
-    : SubwordLearner(verbose)
+                                             bool keep_input_file,
+                                             size_t num_threads)
+    : SubwordLearner(verbose, nullptr, num_threads)
     , _input_filename(input_filename)
     , _keep_vocab(keep_vocab)
     , _keep_input_file(keep_input_file)
   {
     for(size_t i = 0; i < opts.size(); i += 2)
       _args += opts[i] + "=" + opts[i + 1] + " ";
+    _deduplicate = can_deduplicate(_args);
   }
 
   SentencePieceLearner::SentencePieceLearner(bool verbose,
                                              const std::unordered_map<std::string, std::string>& opts,
                                              const std::string& input_filename,
                                              bool keep_vocab,
-                                             bool keep_input_file)
-    : SubwordLearner(verbose)
+                                             bool keep_input_file,
+                                             size_t num_threads)
+    : SubwordLearner(verbose, nullptr, num_threads)
     , _input_filename(input_filename)
     , _keep_vocab(keep_vocab)
     , _keep_input_file(keep_input_file)
   {
     for (const auto& pair : opts)
       _args += " --" + pair.first + "=" + pair.second;
-  }
-
-  SentencePieceLearner::~SentencePieceLearner()
-  {
-    if (!_keep_input_file) {
-      remove(_input_filename.c_str());
-    }
+    _deduplicate = can_deduplicate(_args);
   }
 
   void SentencePieceLearner::set_input_filename(const std::string& filename)
   {
-    if (_input_stream)
-      _input_stream.reset();
     _input_filename = filename;
   }
 
   void SentencePieceLearner::ingest_token_impl(const std::string& token)
   {
-    if (!_input_stream)
-      _input_stream.reset(new std::ofstream(_input_filename));
-    *_input_stream << token << '\n';
+    add_sentence(token, 1);
+  }
+
+  void SentencePieceLearner::ingest_batch(const std::vector<std::string>& lines,
+                                          const Tokenizer& tokenizer)
+  {
+    if (_num_threads <= 1)
+    {
+      SubwordLearner::ingest_batch(lines, tokenizer);
+      return;
+    }
+
+    // Each thread collects (or counts) the sentences of a range of lines. The ranges are
+    // merged in order, so that the trainer input does not depend on the number of threads.
+    struct RangeCounts
+    {
+      std::vector<std::string> sentences;
+      std::unordered_map<std::string, size_t> index;
+      std::vector<std::pair<std::string, int64_t>> counts;
+    };
+
+    const size_t num_ranges = get_num_ranges(lines.size(), _num_threads, 1);
+    std::vector<RangeCounts> ranges(num_ranges);
+    ThreadPool::get_shared().parallel_for(num_ranges, num_ranges, [&](size_t r) {
+      const auto range = get_range(lines.size(), num_ranges, r);
+      auto& range_counts = ranges[r];
+      std::vector<Token> tokens;
+      for (size_t i = range.first; i < range.second; ++i)
+      {
+        tokens.clear();
+        tokenizer.tokenize(lines[i], tokens);
+        for (const auto& token : tokens)
+        {
+          if (!should_ingest(token))
+            continue;
+          if (!_deduplicate)
+          {
+            range_counts.sentences.emplace_back(token.surface);
+            continue;
+          }
+          auto it = range_counts.index.try_emplace(token.surface, range_counts.counts.size());
+          if (it.second)
+            range_counts.counts.emplace_back(token.surface, 0);
+          range_counts.counts[it.first->second].second++;
+        }
+      }
+    });
+
+    for (auto& range_counts : ranges)
+    {
+      for (auto& sentence : range_counts.sentences)
+        _raw_sentences.emplace_back(std::move(sentence));
+      for (const auto& count : range_counts.counts)
+        add_sentence(count.first, count.second);
+    }
+  }
+
+  void SentencePieceLearner::add_sentence(const std::string& sentence, int64_t count)
+  {
+    if (!_deduplicate)
+    {
+      _raw_sentences.insert(_raw_sentences.end(), count, sentence);
+      return;
+    }
+
+    // Tabs separate the sentence from its count in the trainer input. They are replaced by
+    // spaces, as done by the default normalization rules.
+    if (sentence.find('\t') != std::string::npos)
+    {
+      std::string copy(sentence);
+      std::replace(copy.begin(), copy.end(), '\t', ' ');
+      add_sentence(copy, count);
+      return;
+    }
+
+    auto it = _sentence_counts.try_emplace(sentence, 0);
+    if (it.second)
+      _sentences.emplace_back(&*it.first);
+    it.first->second += count;
   }
 
-  void SentencePieceLearner::learn(std::ostream& os, const char* description, bool verbose)
+  void SentencePieceLearner::learn(std::ostream& os, const char*, bool verbose)
   {
     if (_keep_vocab)
       throw std::invalid_argument("stream API does not support keeping the SentencePiece vocabulary");
-    std::string model_path = _input_filename + ".out";
-    learn(model_path, description, verbose);
 
-    // Move the model content into the output stream.
-    os << std::ifstream(model_path).rdbuf();
-    remove(model_path.c_str());
+    std::string model;
+    train(_args, &model, verbose);
+    os.write(model.data(), model.size());
   }
 
   void SentencePieceLearner::learn(const std::string& model_path, const char*, bool verbose)
   {
-    verbose = verbose || _verbose;
-    if (_input_stream) {
-      _input_stream->flush();
-      _input_stream.reset();  // Freeze the input file for training.
+    if (_keep_vocab)
+    {
+      // The trainer writes the model and vocabulary files.
+      train(_args + " --model_prefix=" + model_path, nullptr, verbose);
+      return;
     }
 
+    std::string model;
+    train(_args, &model, verbose);
+
+    std::ofstream out(model_path, std::ios::binary);
+    if (!out)
+      throw std::invalid_argument("Failed to open output file " + model_path);
+    out.write(model.data(), model.size());
+  }
+
+  void SentencePieceLearner::train(const std::string& args,
+                                   std::string* serialized_model,
+                                   bool verbose)
+  {
+    verbose = verbose || _verbose;
+
+    sentencepiece::util::Status status;
     if (!verbose)
       std::cerr.setstate(std::ios_base::failbit);
-    auto status = sentencepiece::SentencePieceTrainer::Train(_args
-                                                             + " --input=" + _input_filename
-                                                             + " --model_prefix=" + model_path);
+    if (_deduplicate)
+    {
+      if (_keep_input_file && !_input_filename.empty())
+        save_sentences(_sentences, _input_filename);
+      SentenceIterator<decltype(_sentences)> sentences(_sentences);
+      status = sentencepiece::SentencePieceTrainer::Train(args + " --input_format=tsv",
+                                                          &sentences,
+                                                          serialized_model);
+    }
+    else
+    {
+      if (_keep_input_file && !_input_filename.empty())
+        save_sentences(_raw_sentences, _input_filename);
+      SentenceIterator<decltype(_raw_sentences)> sentences(_raw_sentences);
+      status = sentencepiece::SentencePieceTrainer::Train(args, &sentences, serialized_model);
+    }
     if (!verbose)
       std::cerr.clear();
 
-    // Cleanup the input file.
-    if (!_keep_input_file) { remove(_input_filename.c_str()); }
-
-    std::string sp_model_path = model_path + ".model";
-    std::string sp_vocab_path = model_path + ".vocab";
+    // The ingested sentences are consumed by the training.
+    _raw_sentences = {};
+    _sentences = {};
+    _sentence_counts = {};
 
     if (!status.ok())
-    {
-      // Cleanup the output files on error.
-      remove(sp_model_path.c_str());
-      remove(sp_vocab_path.c_str());
       throw std::runtime_error("SentencePieceTrainer: " + status.ToString());
-    }
-    else if (!_keep_vocab)
-    {
-      // Remove the generated vocabulary and move the model to the request path.
-      rename(sp_model_path.c_str(), model_path.c_str());
-      remove(sp_vocab_path.c_str());
-    }
   }
 
 }
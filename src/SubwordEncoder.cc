@@ -1,14 +1,118 @@
 #include "onmt/SubwordEncoder.h"
 
+#include <algorithm>
+#include <atomic>
 #include <fstream>
 #include <limits>
+#include <list>
+#include <mutex>
 #include <stdexcept>
+#include <string_view>
+#include <unordered_map>
 
 #include "Casing.h"
 
 namespace onmt
 {
 
+  // LRU cache of encoded words. Entries are distributed over shards that each have
+  // their own lock so that concurrent tokenizations rarely wait on each other.
+  class SubwordEncoder::Cache
+  {
+  public:
+    Cache(size_t capacity)
+      : _capacity(capacity)
+      , _shards(std::min(capacity, max_shards))
+      , _shard_capacity((capacity + _shards.size() - 1) / _shards.size())
+      , _hits(0)
+      , _misses(0)
+    {
+    }
+
+    size_t capacity() const
+    {
+      return _capacity;
+    }
+
+    CacheStats stats() const
+    {
+      CacheStats stats;
+      stats.hits = _hits.load(std::memory_order_relaxed);
+      stats.misses = _misses.load(std::memory_order_relaxed);
+      return stats;
+    }
+
+    bool get(const std::string& word, std::vector<std::string>& pieces)
+    {
+      Shard& shard = get_shard(word);
+      {
+        const std::lock_guard<std::mutex> lock(shard.mutex);
+        const auto it = shard.index.find(word);
+        if (it != shard.index.end())
+        {
+          shard.entries.splice(shard.entries.begin(), shard.entries, it->second);
+          pieces = it->second->second;
+          _hits.fetch_add(1, std::memory_order_relaxed);
+          return true;
+        }
+      }
+      _misses.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    void put(const std::string& word, const std::vector<std::string>& pieces)
+    {
+      Shard& shard = get_shard(word);
+      const std::lock_guard<std::mutex> lock(shard.mutex);
+      if (shard.index.find(word) != shard.index.end())
+        return;  // Added by another thread in the meantime.
+      if (shard.entries.size() >= _shard_capacity)
+      {
+        shard.index.erase(shard.entries.back().first);
+        shard.entries.pop_back();
+      }
+      shard.entries.emplace_front(word, pieces);
+      shard.index.emplace(shard.entries.front().first, shard.entries.begin());
+    }
+
+    void clear()
+    {
+      for (auto& shard : _shards)
+      {
+        const std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.index.clear();
+        shard.entries.clear();
+      }
+    }
+
+  private:
+    static constexpr size_t max_shards = 16;
+
+    using Entries = std::list<std::pair<std::string, std::vector<std::string>>>;
+
+    struct Shard
+    {
+      std::mutex mutex;
+      Entries entries;  // Most recently used first.
+      std::unordered_map<std::string_view, Entries::iterator> index;  // Keys are owned by entries.
+    };
+
+    const size_t _capacity;
+    std::vector<Shard> _shards;
+    const size_t _shard_capacity;
+    std::atomic<size_t> _hits;
+    std::atomic<size_t> _misses;
+
+    Shard& get_shard(const std::string& word)
+    {
+      return _shards[std::hash<std::string_view>()(word) % _shards.size()];
+    }
+  };
+
+
+  SubwordEncoder::SubwordEncoder() = default;
+  SubwordEncoder::~SubwordEncoder() = default;
+
   void SubwordEncoder::update_tokenization_options(Tokenizer::Options&) const
   {
   }
@@ -93,6 +197,50 @@ namespace onmt
     return segments;
   }
 
+  void SubwordEncoder::set_cache_size(size_t cache_size)
+  {
+    if (cache_size == 0)
+      _cache.reset();
+    else
+      _cache = std::make_shared<Cache>(cache_size);
+  }
+
+  size_t SubwordEncoder::get_cache_size() const
+  {
+    return _cache ? _cache->capacity() : 0;
+  }
+
+  SubwordEncoder::CacheStats SubwordEncoder::get_cache_stats() const
+  {
+    return _cache ? _cache->stats() : CacheStats();
+  }
+
+  bool SubwordEncoder::is_sampling(bool) const
+  {
+    return false;
+  }
+
+  std::vector<std::string> SubwordEncoder::encode_with_cache(const std::string& str,
+                                                             bool training) const
+  {
+    if (!_cache || is_sampling(training))
+      return encode(str, training);
+
+    std::vector<std::string> pieces;
+    if (!_cache->get(str, pieces))
+    {
+      pieces = encode(str, training);
+      _cache->put(str, pieces);
+    }
+    return pieces;
+  }
+
+  void SubwordEncoder::clear_cache()
+  {
+    if (_cache)
+      _cache->clear();
+  }
+
   void SubwordEncoder::propagate_token_properties(const Token& token, std::vector<Token>& tokens)
   {
     if (token.casing != Casing::None)
@@ -103,7 +251,7 @@ namespace onmt
         if (casing == Casing::Capitalized && i > 0)
           casing = Casing::Lowercase;
         else if (casing == Casing::Mixed)
-          casing = lowercase_token(tokens[i].surface).second;
+          casing = get_token_casing(tokens[i].surface);
         tokens[i].casing = casing;
       }
     }
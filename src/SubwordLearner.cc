@@ -1,5 +1,7 @@
 #include "onmt/SubwordLearner.h"
 
+#include <algorithm>
+#include <chrono>
 #include <fstream>
 #include <sstream>
 #include <stdexcept>
@@ -7,17 +9,25 @@
 namespace onmt
 {
 
-  SubwordLearner::SubwordLearner(bool verbose, const Tokenizer* default_tokenizer)
+  SubwordLearner::SubwordLearner(bool verbose,
+                                 const Tokenizer* default_tokenizer,
+                                 size_t num_threads)
     : _verbose(verbose)
     , _default_tokenizer(default_tokenizer
                          ? default_tokenizer
                          : new Tokenizer(Tokenizer::Mode::None, Tokenizer::Flags::NoSubstitution))
+    , _num_threads(num_threads)
   {
   }
 
+  bool SubwordLearner::should_ingest(const Token& token)
+  {
+    return !token.empty() && !token.is_placeholder();
+  }
+
   void SubwordLearner::ingest_token(const Token& token)
   {
-    if (!token.empty() && !token.is_placeholder())
+    if (should_ingest(token))
       ingest_token_impl(token.surface);
   }
 
@@ -41,9 +51,67 @@ namespace onmt
 
   void SubwordLearner::ingest(std::istream& is, const Tokenizer* tokenizer)
   {
+    if (!tokenizer)
+      tokenizer = _default_tokenizer.get();
+
+    const auto start = std::chrono::steady_clock::now();
+    size_t num_lines = 0;
+
+    static constexpr size_t batch_size = 10000;
+    std::vector<std::string> lines;
+    lines.reserve(batch_size);
+
     std::string line;
     while (std::getline(is, line))
-      ingest(line, tokenizer);
+    {
+      lines.emplace_back(std::move(line));
+      if (lines.size() == batch_size)
+      {
+        ingest_batch(lines, *tokenizer);
+        num_lines += lines.size();
+        lines.clear();
+      }
+    }
+
+    if (!lines.empty())
+    {
+      ingest_batch(lines, *tokenizer);
+      num_lines += lines.size();
+    }
+
+    if (_verbose)
+    {
+      const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      std::cerr << "Ingested " << num_lines << " lines in " << elapsed.count() << "s ("
+                << static_cast<size_t>(num_lines / std::max(elapsed.count(), 1e-9))
+                << " lines/s)" << std::endl;
+    }
+  }
+
+  void SubwordLearner::ingest(const std::vector<std::string>& lines, const Tokenizer* tokenizer)
+  {
+    if (!tokenizer)
+      tokenizer = _default_tokenizer.get();
+    ingest_batch(lines, *tokenizer);
+  }
+
+  void SubwordLearner::ingest_batch(const std::vector<std::string>& lines,
+                                    const Tokenizer& tokenizer)
+  {
+    if (_num_threads <= 1)
+    {
+      for (const auto& line : lines)
+        ingest(line, &tokenizer);
+      return;
+    }
+
+    std::vector<std::vector<Token>> batch_tokens;
+    tokenizer.tokenize_batch(lines, batch_tokens, _num_threads);
+    for (const auto& tokens : batch_tokens)
+    {
+      for (const auto& token : tokens)
+        ingest_token(token);
+    }
   }
 
   void SubwordLearner::learn(const std::string& model_path, const char* description, bool verbose)
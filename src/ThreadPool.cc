@@ -0,0 +1,152 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <memory>
+
+namespace onmt
+{
+
+  ThreadPool& ThreadPool::get_shared()
+  {
+    static ThreadPool pool;
+    return pool;
+  }
+
+  ThreadPool::~ThreadPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _end_requested = true;
+    }
+
+    _cv.notify_all();
+    for (auto& worker : _workers)
+      worker.join();
+  }
+
+  size_t ThreadPool::num_threads() const
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _workers.size();
+  }
+
+  void ThreadPool::resize(size_t num_threads)
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    while (_workers.size() < num_threads)
+      _workers.emplace_back(&ThreadPool::work_loop, this);
+  }
+
+  void ThreadPool::post(std::function<void()> job)
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.emplace(std::move(job));
+    }
+    _cv.notify_one();
+  }
+
+  void ThreadPool::work_loop()
+  {
+    while (true)
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _cv.wait(lock, [this]{
+        return !_jobs.empty() || _end_requested;
+      });
+
+      if (_jobs.empty())  // End requested.
+        break;
+
+      auto job = std::move(_jobs.front());
+      _jobs.pop();
+      lock.unlock();
+
+      job();
+    }
+  }
+
+  // State shared by the threads running a parallel_for. The helper jobs may start after
+  // the call returned (e.g. when the workers are busy with other calls), so they keep
+  // the state alive and only call the function when there is an index left to claim.
+  struct ParallelForState
+  {
+    ParallelForState(size_t size_, const std::function<void(size_t)>& function_)
+      : size(size_)
+      , function(function_)
+    {
+    }
+
+    const size_t size;
+    const std::function<void(size_t)>& function;
+    std::atomic<size_t> next_index{0};
+    std::atomic<bool> failed{false};
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    size_t num_done = 0;
+    std::exception_ptr exception;
+
+    void run()
+    {
+      size_t num_processed = 0;
+      std::exception_ptr local_exception;
+
+      for (size_t i = next_index++; i < size; i = next_index++)
+      {
+        if (!failed)
+        {
+          try
+          {
+            function(i);
+          }
+          catch (...)
+          {
+            if (!local_exception)
+              local_exception = std::current_exception();
+            failed = true;
+          }
+        }
+        ++num_processed;
+      }
+
+      if (num_processed == 0)
+        return;
+
+      std::lock_guard<std::mutex> lock(mutex);
+      if (local_exception && !exception)
+        exception = local_exception;
+      num_done += num_processed;
+      if (num_done == size)
+        cv.notify_all();
+    }
+  };
+
+  void ThreadPool::parallel_for(size_t size,
+                                size_t num_threads,
+                                const std::function<void(size_t)>& function)
+  {
+    num_threads = std::min(num_threads, size);
+    if (num_threads <= 1)
+    {
+      for (size_t i = 0; i < size; ++i)
+        function(i);
+      return;
+    }
+
+    resize(num_threads - 1);
+
+    auto state = std::make_shared<ParallelForState>(size, function);
+    for (size_t i = 0; i < num_threads - 1; ++i)
+      post([state]{ state->run(); });
+    state->run();
+
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->cv.wait(lock, [&state]{ return state->num_done == state->size; });
+    if (state->exception)
+      std::rethrow_exception(state->exception);
+  }
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace onmt
+{
+
+  // Splits [0, size) in up to num_threads ranges of at least min_range_size items.
+  inline size_t get_num_ranges(size_t size, size_t num_threads, size_t min_range_size)
+  {
+    return std::max(std::min(num_threads, size / min_range_size), size_t(1));
+  }
+
+  inline std::pair<size_t, size_t> get_range(size_t size, size_t num_ranges, size_t index)
+  {
+    return std::make_pair(size * index / num_ranges, size * (index + 1) / num_ranges);
+  }
+
+  // Pool of worker threads that are kept alive between calls, so that the thread local
+  // tokenization workspaces are also reused.
+  class ThreadPool
+  {
+  public:
+    // Returns the pool shared by the library.
+    static ThreadPool& get_shared();
+
+    ThreadPool() = default;
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t num_threads() const;
+
+    // Calls function(i) for each i in [0, size) with up to num_threads threads, including
+    // the calling thread. Each thread claims the next index when it is done with the
+    // previous one, so that long and short items are balanced between threads.
+    // Workers are added to the pool when needed. Blocks until all calls returned and
+    // rethrows the first exception, if any.
+    void parallel_for(size_t size,
+                      size_t num_threads,
+                      const std::function<void(size_t)>& function);
+
+  private:
+    std::vector<std::thread> _workers;
+    std::queue<std::function<void()>> _jobs;
+    mutable std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _end_requested = false;
+
+    void resize(size_t num_threads);
+    void post(std::function<void()> job);
+    void work_loop();
+  };
+
+}
@@ -0,0 +1,180 @@
+#include "onmt/TokenBatch.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Utils.h"
+
+namespace onmt
+{
+
+  // Memory blocks in which surfaces are copied. Blocks are never reallocated so that
+  // views on their content remain valid until the storage is cleared.
+  class TokenBatch::Storage
+  {
+  public:
+    char* extend(const char* data, size_t size, size_t extra_size)
+    {
+      if (_active < _blocks.size())
+      {
+        Block& block = _blocks[_active];
+        char* block_end = block.data.get() + block.used;
+
+        // Grow the region in place if it ends the active block.
+        if (data && data + size == block_end && block.used + extra_size <= block.capacity)
+        {
+          block.used += extra_size;
+          return const_cast<char*>(data);
+        }
+
+        if (block.used + size + extra_size <= block.capacity)
+        {
+          block.used += size + extra_size;
+          return copy_region(block_end, data, size);
+        }
+      }
+
+      Block& block = next_block(size + extra_size);
+      block.used = size + extra_size;
+      return copy_region(block.data.get(), data, size);
+    }
+
+    void clear()
+    {
+      for (auto& block : _blocks)
+        block.used = 0;
+      _active = 0;
+    }
+
+  private:
+    static constexpr size_t default_block_size = 4096;
+
+    struct Block
+    {
+      std::unique_ptr<char[]> data;
+      size_t capacity;
+      size_t used;
+    };
+
+    std::vector<Block> _blocks;
+    size_t _active = 0;
+
+    static char* copy_region(char* destination, const char* data, size_t size)
+    {
+      if (size > 0)
+        std::memmove(destination, data, size);
+      return destination;
+    }
+
+    Block& next_block(size_t min_capacity)
+    {
+      // Reuse the following blocks that were allocated before the last clear.
+      if (!_blocks.empty())
+        ++_active;
+      while (_active < _blocks.size() && _blocks[_active].capacity < min_capacity)
+        ++_active;
+
+      if (_active == _blocks.size())
+      {
+        const size_t capacity = std::max(default_block_size, min_capacity * 2);
+        _blocks.emplace_back(Block{std::unique_ptr<char[]>(new char[capacity]), capacity, 0});
+      }
+
+      return _blocks[_active];
+    }
+  };
+
+
+  bool TokenSpan::is_placeholder() const
+  {
+    return ::onmt::is_placeholder(surface);
+  }
+
+
+  TokenBatch::TokenBatch()
+    : _storage(std::make_unique<Storage>())
+  {
+  }
+
+  TokenBatch::~TokenBatch() = default;
+  TokenBatch::TokenBatch(TokenBatch&&) noexcept = default;
+  TokenBatch& TokenBatch::operator=(TokenBatch&&) noexcept = default;
+
+  void TokenBatch::clear()
+  {
+    _tokens.clear();
+    _features.clear();
+    if (_storage)
+      _storage->clear();
+  }
+
+  char* TokenBatch::extend_storage(const char* data, size_t size, size_t extra_size)
+  {
+    if (!_storage)  // Moved from.
+      _storage = std::make_unique<Storage>();
+    return _storage->extend(data, size, extra_size);
+  }
+
+  std::string_view TokenBatch::copy_to_storage(std::string_view str)
+  {
+    if (str.empty())
+      return str;
+    char* data = extend_storage(nullptr, 0, str.size());
+    std::memcpy(data, str.data(), str.size());
+    return std::string_view(data, str.size());
+  }
+
+  void TokenBatch::assign(const std::vector<Token>& tokens)
+  {
+    clear();
+    _tokens.reserve(tokens.size());
+
+    for (const auto& token : tokens)
+    {
+      TokenSpan span;
+      span.surface = copy_to_storage(token.surface);
+      span.type = token.type;
+      span.casing = token.casing;
+      span.join_left = token.join_left;
+      span.join_right = token.join_right;
+      span.spacer = token.spacer;
+      span.preserve = token.preserve;
+      span.features_offset = _features.size();
+      span.num_features = token.features.size();
+      for (const auto& feature : token.features)
+        _features.emplace_back(copy_to_storage(feature));
+      _tokens.emplace_back(std::move(span));
+    }
+  }
+
+  void TokenBatch::to_tokens(std::vector<Token>& tokens) const
+  {
+    tokens.reserve(tokens.size() + _tokens.size());
+
+    for (const auto& span : _tokens)
+    {
+      Token token(std::string(span.surface));
+      token.type = span.type;
+      token.casing = span.casing;
+      token.join_left = span.join_left;
+      token.join_right = span.join_right;
+      token.spacer = span.spacer;
+      token.preserve = span.preserve;
+      if (span.num_features > 0)
+      {
+        token.features.reserve(span.num_features);
+        for (size_t i = 0; i < span.num_features; ++i)
+          token.features.emplace_back(get_feature(span, i));
+      }
+      tokens.emplace_back(std::move(token));
+    }
+  }
+
+  std::vector<Token> TokenBatch::to_tokens() const
+  {
+    std::vector<Token> tokens;
+    to_tokens(tokens);
+    return tokens;
+  }
+
+}
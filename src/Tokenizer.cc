@@ -1,9 +1,14 @@
 #include "onmt/Tokenizer.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "onmt/BPE.h"
 #include "onmt/SentencePiece.h"
+#include "onmt/Vocab.h"
 #include "onmt/unicode/Unicode.h"
 #include "Casing.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 
 namespace onmt
@@ -76,6 +81,73 @@ namespace onmt
     Placeholder,
   };
 
+  // Options that are checked in the per character and per token loops. The generic kernel
+  // reads them at runtime.
+  class RuntimeOptions
+  {
+  public:
+    RuntimeOptions(const Tokenizer::Options& options, bool segment_alphabet)
+      : _options(options)
+      , _segment_alphabet(segment_alphabet)
+    {
+    }
+
+    Tokenizer::Mode mode() const { return _options.mode; }
+    bool support_prior_joiners() const { return _options.support_prior_joiners; }
+    bool segment_case() const { return _options.segment_case; }
+    bool segment_numbers() const { return _options.segment_numbers; }
+    bool segment_alphabet() const { return _segment_alphabet; }
+    bool segment_alphabet_change() const { return _options.segment_alphabet_change; }
+    bool allow_isolated_marks() const { return _options.allow_isolated_marks; }
+    bool preserve_placeholders() const { return _options.preserve_placeholders; }
+    bool preserve_segmented_tokens() const { return _options.preserve_segmented_tokens; }
+    bool with_separators() const { return _options.with_separators; }
+    bool case_markup() const { return _options.case_markup; }
+    bool joiner_annotate() const { return _options.joiner_annotate; }
+    bool joiner_new() const { return _options.joiner_new; }
+    bool spacer_annotate() const { return _options.spacer_annotate; }
+    bool spacer_new() const { return _options.spacer_new; }
+
+  private:
+    const Tokenizer::Options& _options;
+    const bool _segment_alphabet;
+  };
+
+  // Options of the specialized segmentation kernels: the mode is fixed and the other
+  // options have their default value, so that the compiler removes their branches.
+  template <Tokenizer::Mode Mode>
+  struct DefaultSegmentation
+  {
+    static constexpr Tokenizer::Mode mode() { return Mode; }
+    static constexpr bool support_prior_joiners() { return false; }
+    static constexpr bool segment_case() { return false; }
+    static constexpr bool segment_numbers() { return false; }
+    static constexpr bool segment_alphabet() { return false; }
+    static constexpr bool segment_alphabet_change() { return false; }
+    static constexpr bool allow_isolated_marks() { return false; }
+    static constexpr bool preserve_placeholders() { return false; }
+    static constexpr bool preserve_segmented_tokens() { return false; }
+    static constexpr bool with_separators() { return false; }
+  };
+
+  enum class Annotation
+  {
+    None,
+    Joiner,
+    Spacer,
+  };
+
+  // Same for the annotation of the final tokens.
+  template <Annotation Type>
+  struct DefaultAnnotation
+  {
+    static constexpr bool case_markup() { return false; }
+    static constexpr bool joiner_annotate() { return Type == Annotation::Joiner; }
+    static constexpr bool joiner_new() { return false; }
+    static constexpr bool spacer_annotate() { return Type == Annotation::Spacer; }
+    static constexpr bool spacer_new() { return false; }
+  };
+
 
   Tokenizer::Options::Options(Mode mode_, int flags, const std::string& joiner_)
   {
@@ -160,6 +232,7 @@ namespace onmt
     : _options(std::move(options))
   {
     _options.validate();
+    select_kernel();
     set_subword_encoder(subword_encoder);
   }
 
@@ -172,6 +245,7 @@ namespace onmt
     : _options(mode, flags, joiner)
   {
     _options.validate();
+    select_kernel();
     if (!model_path.empty())
     {
       SubwordEncoder* subword_encoder = nullptr;
@@ -194,6 +268,7 @@ namespace onmt
     : _options(mode, flags, joiner)
   {
     _options.validate();
+    select_kernel();
     set_subword_encoder(std::shared_ptr<const SubwordEncoder>(subword_encoder));
   }
 
@@ -206,9 +281,43 @@ namespace onmt
     : _options(mode, flags, joiner)
   {
     _options.validate();
+    select_kernel();
     set_subword_encoder(std::make_shared<const SentencePiece>(sp_model_path, sp_nbest_size, sp_alpha));
   }
 
+  void Tokenizer::select_kernel()
+  {
+    _kernel = Kernel::Generic;
+    if (_options.support_prior_joiners
+        || _options.segment_case
+        || _options.segment_numbers
+        || !_options.segment_alphabet_codes.empty()
+        || _options.segment_alphabet_change
+        || _options.allow_isolated_marks
+        || _options.preserve_placeholders
+        || _options.preserve_segmented_tokens
+        || _options.with_separators
+        || _options.case_markup
+        || _options.joiner_new
+        || _options.spacer_new)
+      return;
+
+    switch (_options.mode)
+    {
+    case Mode::Conservative:
+      _kernel = Kernel::Conservative;
+      break;
+    case Mode::Aggressive:
+      _kernel = Kernel::Aggressive;
+      break;
+    case Mode::None:
+      _kernel = Kernel::None;
+      break;
+    default:
+      break;
+    }
+  }
+
   std::string Tokenizer::detokenize(const std::vector<std::string>& words,
                                     const std::vector<std::vector<std::string> >& features) const
   {
@@ -320,20 +429,21 @@ namespace onmt
     std::string line;
     line.reserve(tokens.size() * 10);
 
+    std::string prep_word;
     for (size_t i = 0; i < tokens.size(); ++i)
     {
       const auto& token = tokens[i];
       if (!_options.with_separators && i > 0 && !tokens[i - 1].join_right && !token.join_left)
         line += ' ';
 
-      std::string prep_word = token.surface;
-
+      prep_word.clear();
       if (!token.is_placeholder())
       {
-        if (token.casing != Casing::None && token.casing != Casing::Lowercase)
-          prep_word = restore_token_casing(prep_word, token.casing, _options.lang);
+        restore_token_casing(token.surface, token.casing, _options.lang, prep_word);
         unescape_characters(prep_word);
       }
+      else
+        prep_word = token.surface;
 
       if (!prep_word.empty())
       {
@@ -488,44 +598,197 @@ namespace onmt
     return tokenize(text, annotated_tokens, nullptr, training);
   }
 
+  // Runs function with a workspace that is reused by the next tokenizations in the
+  // same thread, e.g. in the tokenize_stream workers.
+  template <typename Function>
+  static inline void with_thread_workspace(const std::string& text, const Function& function)
+  {
+    // Do not keep the memory used for very long texts.
+    static constexpr size_t max_retained_text_size = 1 << 16;
+    static thread_local TokenizationWorkspace workspace;
+
+    function(workspace);
+    if (text.size() > max_retained_text_size)
+      workspace = TokenizationWorkspace();
+  }
+
   void Tokenizer::tokenize(const std::string& text,
                            std::vector<std::string>& words,
                            std::vector<std::vector<std::string> >& features,
                            std::unordered_map<std::string, size_t>* alphabets,
                            bool training) const
   {
-    std::vector<Token> annotated_tokens;
-    tokenize(text, annotated_tokens, alphabets, training);
+    with_thread_workspace(text, [&](TokenizationWorkspace& workspace) {
+      auto& annotated_tokens = workspace._tokens;
+      annotated_tokens.clear();
+      tokenize(text, annotated_tokens, alphabets, workspace, training);
+      finalize_tokens(annotated_tokens, words, features);
+    });
+  }
+
+  void Tokenizer::tokenize(const std::string& text,
+                           std::vector<std::string>& words,
+                           std::vector<std::vector<std::string> >& features,
+                           TokenizationWorkspace& workspace,
+                           bool training) const
+  {
+    auto& annotated_tokens = workspace._tokens;
+    annotated_tokens.clear();
+    tokenize(text, annotated_tokens, nullptr, workspace, training);
     finalize_tokens(annotated_tokens, words, features);
   }
 
+  void Tokenizer::tokenize_and_write(const std::string& text,
+                                     std::string& output,
+                                     const std::string& tokens_delimiter,
+                                     bool training) const
+  {
+    with_thread_workspace(text, [&](TokenizationWorkspace& workspace) {
+      auto& annotated_tokens = workspace._tokens;
+      annotated_tokens.clear();
+      tokenize(text, annotated_tokens, nullptr, workspace, training);
+      finalize_tokens(annotated_tokens, output, tokens_delimiter, workspace._token_buffer);
+    });
+  }
+
+  void Tokenizer::tokenize(const std::string& text,
+                           TokenBatch& batch,
+                           bool training) const
+  {
+    with_thread_workspace(text, [&](TokenizationWorkspace& workspace) {
+      tokenize(text, batch, workspace, training);
+    });
+  }
+
+  void Tokenizer::tokenize(const std::string& text,
+                           TokenBatch& batch,
+                           TokenizationWorkspace& workspace,
+                           bool training) const
+  {
+    batch.clear();
+    if (text.empty())
+      return;
+
+    tokenize_spans(text, batch, nullptr, workspace);
+
+    // Lowercasing and subword encoding generate new surfaces.
+    if (((_options.case_markup || _options.case_feature) && !lowercase_while_segmenting())
+        || _subword_encoder)
+    {
+      auto& annotated_tokens = workspace._tokens;
+      annotated_tokens.clear();
+      batch.to_tokens(annotated_tokens);
+      lowercase_and_encode(annotated_tokens, training);
+      batch.assign(annotated_tokens);
+    }
+  }
+
+  void Tokenizer::tokenize_batch(const std::vector<std::string>& texts,
+                                 std::vector<std::vector<Token>>& tokens,
+                                 size_t num_threads,
+                                 bool training) const
+  {
+    tokens.resize(texts.size());
+    ThreadPool::get_shared().parallel_for(texts.size(), num_threads, [&](size_t i) {
+      tokens[i].clear();
+      tokenize(texts[i], tokens[i], training);
+    });
+  }
+
+  void Tokenizer::tokenize_batch(const std::vector<std::string>& texts,
+                                 std::vector<std::vector<std::string>>& words,
+                                 std::vector<std::vector<std::vector<std::string>>>& features,
+                                 size_t num_threads,
+                                 bool training) const
+  {
+    words.resize(texts.size());
+    features.resize(texts.size());
+    ThreadPool::get_shared().parallel_for(texts.size(), num_threads, [&](size_t i) {
+      words[i].clear();
+      features[i].clear();
+      tokenize(texts[i], words[i], features[i], training);
+    });
+  }
+
   void Tokenizer::tokenize(const std::string& text,
                            std::vector<Token>& annotated_tokens,
                            std::unordered_map<std::string, size_t>* alphabets,
                            bool training) const
+  {
+    with_thread_workspace(text, [&](TokenizationWorkspace& workspace) {
+      tokenize(text, annotated_tokens, alphabets, workspace, training);
+    });
+  }
+
+  void Tokenizer::tokenize(const std::string& text,
+                           std::vector<Token>& annotated_tokens,
+                           std::unordered_map<std::string, size_t>* alphabets,
+                           TokenizationWorkspace& workspace,
+                           bool training) const
   {
     if (text.empty())
       return;
 
-    annotated_tokens.reserve(text.size());
+    auto& batch = workspace._batch;
+    batch.clear();
+    tokenize_spans(text, batch, alphabets, workspace);
+    batch.to_tokens(annotated_tokens);
+    lowercase_and_encode(annotated_tokens, training);
+  }
 
-    switch (_options.mode)
+  void Tokenizer::tokenize_spans(const std::string& text,
+                                 TokenBatch& batch,
+                                 std::unordered_map<std::string, size_t>* alphabets,
+                                 TokenizationWorkspace& workspace) const
+  {
+    switch (_kernel)
     {
-    case Mode::None:
-    case Mode::Space:
-      tokenize_on_placeholders(text, annotated_tokens);
+    case Kernel::Conservative:
+      tokenize_text(text, batch, alphabets, workspace,
+                    DefaultSegmentation<Mode::Conservative>());
+      break;
+    case Kernel::Aggressive:
+      tokenize_text(text, batch, alphabets, workspace,
+                    DefaultSegmentation<Mode::Aggressive>());
+      break;
+    case Kernel::None:
+      tokenize_on_placeholders(text, batch, workspace, DefaultSegmentation<Mode::None>());
       break;
     default:
-      tokenize_text(text, annotated_tokens, alphabets);
+    {
+      const RuntimeOptions options(_options, !_options.segment_alphabet_codes.empty());
+      if (_options.mode == Mode::None || _options.mode == Mode::Space)
+        tokenize_on_placeholders(text, batch, workspace, options);
+      else
+        tokenize_text(text, batch, alphabets, workspace, options);
       break;
     }
+    }
+  }
+
+  bool Tokenizer::lowercase_while_segmenting() const
+  {
+    // Language specific rules require the full token.
+    return ((_options.case_markup || _options.case_feature)
+            && (_options.lang.empty() || !unicode::support_language_rules())
+            && _options.mode != Mode::None
+            && _options.mode != Mode::Space);
+  }
 
-    if (_options.case_markup || _options.case_feature)
+  void Tokenizer::lowercase_and_encode(std::vector<Token>& annotated_tokens,
+                                       bool training) const
+  {
+    if ((_options.case_markup || _options.case_feature) && !lowercase_while_segmenting())
     {
+      std::string lowercase;
       for (auto& token : annotated_tokens)
       {
         if (!token.is_placeholder())
-          std::tie(token.surface, token.casing) = lowercase_token(token.surface, _options.lang);
+        {
+          lowercase.clear();
+          token.casing = lowercase_token(token.surface, _options.lang, lowercase);
+          token.surface.swap(lowercase);
+        }
       }
     }
 
@@ -533,31 +796,193 @@ namespace onmt
       annotated_tokens = _subword_encoder->encode_and_annotate(annotated_tokens, training);
   }
 
+  // Decodes the text in blocks while it is segmented, so that the text is decoded and its
+  // scripts are resolved in the same pass. Characters are discarded once consumed: only the
+  // current character and the lookahead (e.g. a sequence of combining marks) are kept.
+  class CharStream
+  {
+  public:
+    CharStream(const std::string& text,
+               bool with_scripts,
+               std::vector<unicode::CharInfo>& chars,
+               std::vector<int>& scripts)
+      : _data(text.c_str())
+      , _end(text.c_str() + text.size())
+      , _with_scripts(with_scripts)
+      , _chars(chars)
+      , _scripts(scripts)
+    {
+      _chars.clear();
+      _scripts.clear();
+    }
+
+    // Returns the character at this offset from the current character, or nullptr after
+    // the end of the text. The pointer is invalidated when a character is read further.
+    const unicode::CharInfo* get(size_t offset)
+    {
+      if (offset < _available)
+        return _current + offset;
+      return decode_until(offset);
+    }
+
+    // Returns the script of a character that was read with get(). Scripts are only
+    // resolved when the stream is created with with_scripts.
+    int script(size_t offset) const
+    {
+      return _scripts[_begin + offset];
+    }
+
+    void advance(size_t num_chars)
+    {
+      _begin += num_chars;
+      _current += num_chars;
+      _available -= num_chars;
+    }
+
+  private:
+    static constexpr size_t block_size = 256;
+
+    const char* _data;
+    const char* const _end;
+    const bool _with_scripts;
+    std::vector<unicode::CharInfo>& _chars;
+    std::vector<int>& _scripts;
+    size_t _begin = 0;  // Index of the current character.
+    const unicode::CharInfo* _current = nullptr;
+    size_t _available = 0;  // Number of decoded characters from the current one.
+    int _previous_script = -1;
+
+    const unicode::CharInfo* decode_until(size_t offset)
+    {
+      while (offset >= _available)
+      {
+        if (!decode_block())
+          return nullptr;
+      }
+      return _current + offset;
+    }
+
+    bool decode_block()
+    {
+      if (_data == _end)
+        return false;
+
+      // Drop the consumed characters.
+      _chars.erase(_chars.begin(), _chars.begin() + _begin);
+      if (_with_scripts)
+        _scripts.erase(_scripts.begin(), _scripts.begin() + _begin);
+      _begin = 0;
+
+      const size_t offset = _chars.size();
+      _data = unicode::get_characters_info(_data, _end, block_size, _chars);
+
+      if (_with_scripts)
+      {
+        for (size_t i = offset; i < _chars.size(); ++i)
+        {
+          const int script = unicode::get_script(_chars[i].value, _previous_script);
+          _scripts.emplace_back(script);
+          if (script != -1)
+            _previous_script = script;
+        }
+      }
+
+      _current = _chars.data();
+      _available = _chars.size();
+      return true;
+    }
+  };
+
   class TokensBuilder
   {
   private:
-    std::vector<Token>& _tokens;
+    TokenBatch& _batch;
     const bool _no_substitution;
-    Token _current_token;
+    TokenSpan _current_token;
+    bool _current_in_storage;  // The surface is not a view on the text.
     size_t _current_length;
-    std::string _current_feature;
-
+    std::string_view _current_feature;
+    bool _current_feature_in_storage;
+    // Tokens are lowercased while they are built, with the same result as lowercase_token.
+    const bool _lowercase;
+    bool _lowercase_active;  // Placeholders are not lowercased.
+    Casing _lowercase_casing;
+    size_t _num_letters;
+
+    // Appends characters from the text. The surface remains a view on the text
+    // when they are contiguous to the current surface.
     void append(const char* str, const size_t length)
     {
-      _current_token.append(str, length);
+      auto& surface = _current_token.surface;
+      if (surface.empty())
+        surface = std::string_view(str, length);
+      else if (!_current_in_storage && surface.data() + surface.size() == str)
+        surface = std::string_view(surface.data(), surface.size() + length);
+      else
+        append_to_storage(str, length);
       _current_length += 1;  // Unicode length.
     }
 
+    // Appends characters that are not from the text.
     void append(const std::string& str)
     {
-      append(str.c_str(), str.size());
+      if (_lowercase_active)
+      {
+        std::string lowercase;
+        char buffer[4];
+        for (size_t offset = 0; offset < str.size();)
+        {
+          size_t length = 0;
+          const auto value = unicode::utf8_to_cp(str.c_str() + offset, &length);
+          if (length == 0)
+            break;
+          if (unicode::get_char_type(value) == unicode::CharType::Letter
+              && update_lowercase_casing(unicode::get_case_v2(value)))
+            lowercase.append(buffer, lowercase_char(value, buffer));
+          else
+            lowercase.append(str, offset, length);
+          offset += length;
+        }
+        append_to_storage(lowercase.c_str(), lowercase.size());
+      }
+      else
+        append_to_storage(str.c_str(), str.size());
+      _current_length += 1;
+    }
+
+    void append_letter(const unicode::CharInfo& character);
+
+    // Updates the casing with the next letter and returns true if it should be lowercased.
+    bool update_lowercase_casing(const unicode::CaseType case_type)
+    {
+      _lowercase_casing = update_casing(_lowercase_casing, case_type, _num_letters++);
+      return case_type == unicode::CaseType::Upper;
+    }
+
+    void append_to_storage(const char* str, const size_t length)
+    {
+      auto& surface = _current_token.surface;
+      char* data = _batch.extend_storage(_current_in_storage ? surface.data() : nullptr,
+                                         _current_in_storage ? surface.size() : 0,
+                                         _current_in_storage ? length : surface.size() + length);
+      if (!_current_in_storage)
+        std::memcpy(data, surface.data(), surface.size());
+      std::memcpy(data + surface.size(), str, length);
+      surface = std::string_view(data, surface.size() + length);
+      _current_in_storage = true;
     }
 
   public:
-    TokensBuilder(const Tokenizer::Options& options, std::vector<Token>& tokens)
-      : _tokens(tokens)
+    TokensBuilder(const Tokenizer::Options& options, TokenBatch& batch, bool lowercase = false)
+      : _batch(batch)
       , _no_substitution(options.no_substitution)
+      , _current_in_storage(false)
       , _current_length(0)
+      , _current_feature_in_storage(false)
+      , _lowercase(lowercase)
+      , _lowercase_active(lowercase)
+      , _lowercase_casing(Casing::None)
+      , _num_letters(0)
     {
     }
 
@@ -569,7 +994,7 @@ namespace onmt
 
     size_t num_tokens() const
     {
-      return _tokens.size();
+      return _batch._tokens.size();
     }
 
     bool is_new_token() const
@@ -582,37 +1007,70 @@ namespace onmt
       return _current_length;
     }
 
-    Token& current()
+    TokenSpan& current()
     {
       return _current_token;
     }
 
-    Token& previous()
+    TokenSpan& previous()
     {
-      return _tokens.back();
+      return _batch._tokens.back();
     }
 
     void segment()
     {
       if (!_current_token.empty())
       {
-        _tokens.emplace_back(std::move(_current_token));
-        _current_token = Token();
+        if (_lowercase)
+        {
+          _current_token.casing = _lowercase_casing;
+          _lowercase_casing = Casing::None;
+          _num_letters = 0;
+        }
+        _batch._tokens.emplace_back(std::move(_current_token));
+        _current_token = TokenSpan();
+        _current_in_storage = false;
         _current_length = 0;
       }
     }
 
-    void append(const std::vector<unicode::CharInfo>& chars,
-                const size_t begin,
-                const size_t end)
+    void begin_placeholder()
+    {
+      _lowercase_active = false;
+    }
+
+    void end_placeholder()
+    {
+      _lowercase_active = _lowercase;
+    }
+
+    // Lowercases the current token when it is not a valid placeholder, e.g. when the
+    // placeholder is not closed at the end of the text.
+    void lowercase_current()
+    {
+      end_placeholder();
+      if (!_lowercase || _current_token.empty())
+        return;
+      auto lowercase = lowercase_token(std::string(_current_token.surface));
+      char* data = _batch.extend_storage(nullptr, 0, lowercase.first.size());
+      std::memcpy(data, lowercase.first.data(), lowercase.first.size());
+      _current_token.surface = std::string_view(data, lowercase.first.size());
+      _current_in_storage = true;
+      _lowercase_casing = lowercase.second;
+    }
+
+    void append(CharStream& chars, const size_t begin, const size_t end)
     {
       for (size_t i = begin; i < end; ++i)
-        append(chars[i]);
+        append(*chars.get(i));
     }
 
     void append(const unicode::CharInfo& character)
     {
-      append(character.data, character.length);
+      if (_lowercase_active && character.char_type == unicode::CharType::Letter)
+        append_letter(character);
+      else
+        append(character.data, character.length);
     }
 
     void safe_append(const unicode::CharInfo& character)
@@ -645,22 +1103,57 @@ namespace onmt
     {
       if (!_current_feature.empty())
       {
-        _current_token.append_feature(std::move(_current_feature));
-        _current_feature.clear();
+        if (_current_token.num_features == 0)
+          _current_token.features_offset = _batch._features.size();
+        _current_token.num_features++;
+        _batch._features.emplace_back(_current_feature);
+        _current_feature = std::string_view();
+        _current_feature_in_storage = false;
       }
     }
 
     void append_to_feature(const unicode::CharInfo& character)
     {
-      _current_feature.append(character.data, character.length);
+      auto& feature = _current_feature;
+      if (feature.empty())
+        feature = std::string_view(character.data, character.length);
+      else if (!_current_feature_in_storage
+               && feature.data() + feature.size() == character.data)
+        feature = std::string_view(feature.data(), feature.size() + character.length);
+      else
+      {
+        // The feature is not contiguous in the text, e.g. when invalid characters are skipped.
+        char* data = _batch.extend_storage(nullptr, 0, feature.size() + character.length);
+        std::memcpy(data, feature.data(), feature.size());
+        std::memcpy(data + feature.size(), character.data, character.length);
+        feature = std::string_view(data, feature.size() + character.length);
+        _current_feature_in_storage = true;
+      }
     }
   };
 
+  // Not defined in the class so that append() remains small enough to be inlined.
+  void TokensBuilder::append_letter(const unicode::CharInfo& character)
+  {
+    if (update_lowercase_casing(character.case_type))
+    {
+      char lowercase[4];
+      append_to_storage(lowercase, lowercase_char(character.value, lowercase));
+      _current_length += 1;
+    }
+    else
+      append(character.data, character.length);
+  }
+
+  template <typename Policy>
   void Tokenizer::tokenize_on_placeholders(const std::string& text,
-                                           std::vector<Token>& tokens) const
+                                           TokenBatch& tokens,
+                                           TokenizationWorkspace& workspace,
+                                           const Policy& policy) const
   {
     // Split on characters.
-    const auto chars = unicode::get_characters_info(text);
+    auto& chars = workspace._chars;
+    unicode::get_characters_info(text, chars);
 
     TokensBuilder builder(_options, tokens);
     bool in_placeholder = false;
@@ -674,7 +1167,7 @@ namespace onmt
 
       if (!in_placeholder)
       {
-        if (_options.support_prior_joiners && c == _options.joiner)
+        if (policy.support_prior_joiners() && c == _options.joiner)
         {
           // Mark joint but discard character.
           if (token.empty())
@@ -697,7 +1190,7 @@ namespace onmt
             // Flush accumulated token and mark joint if it did not finish by a separator.
             if (i > 0 && chars[i - 1].char_type != unicode::CharType::Separator)
               token.join_right = true;
-            if (_options.preserve_segmented_tokens)
+            if (policy.preserve_segmented_tokens())
               token.preserve = true;
             builder.segment();
           }
@@ -705,7 +1198,7 @@ namespace onmt
           builder.append(c);
           in_placeholder = true;
         }
-        else if (_options.mode == Mode::Space)
+        else if (policy.mode() == Mode::Space)
         {
           if (c == ITokenizer::feature_marker)
           {
@@ -747,7 +1240,7 @@ namespace onmt
           // character was accumulated.
           if (i + 1 < chars.size() && chars[i + 1].char_type != unicode::CharType::Separator)
             token.join_right = true;
-          if (_options.preserve_placeholders || _options.preserve_segmented_tokens)
+          if (policy.preserve_placeholders() || policy.preserve_segmented_tokens())
             token.preserve = true;
           builder.segment();
           in_placeholder = false;
@@ -756,21 +1249,22 @@ namespace onmt
     }
   }
 
-  static inline size_t get_next_main_char(const std::vector<unicode::CharInfo>& chars,
-                                          const std::vector<int>& scripts,
-                                          size_t offset,
-                                          const Tokenizer::Options& options)
+  // Returns the offset of the next character that is not a combining mark of the current one.
+  template <typename Policy>
+  static inline size_t get_next_main_char(CharStream& chars,
+                                          const unicode::CharInfo& c,
+                                          const Policy& policy)
   {
-    size_t next_offset = offset + 1;
+    size_t next_offset = 1;
 
-    while (next_offset < chars.size()) {
-      if (chars[next_offset].char_type != unicode::CharType::Mark)
+    while (const auto* next_c = chars.get(next_offset)) {
+      if (next_c->char_type != unicode::CharType::Mark)
         break;
 
-      if (options.allow_isolated_marks) {
-        if (chars[offset].char_type == unicode::CharType::Separator)
+      if (policy.allow_isolated_marks()) {
+        if (c.char_type == unicode::CharType::Separator)
           break;
-        if (options.segment_alphabet_change && scripts[next_offset] != scripts[offset])
+        if (policy.segment_alphabet_change() && chars.script(next_offset) != chars.script(0))
           break;
       }
 
@@ -780,49 +1274,45 @@ namespace onmt
     return next_offset;
   }
 
+  template <typename Policy>
   void Tokenizer::tokenize_text(const std::string& text,
-                                std::vector<Token>& annotated_tokens,
-                                std::unordered_map<std::string, size_t>* alphabets) const
+                                TokenBatch& annotated_tokens,
+                                std::unordered_map<std::string, size_t>* alphabets,
+                                TokenizationWorkspace& workspace,
+                                const Policy& policy) const
   {
     // TODO: this method has grown big and is hard to follow. It should be refactored into
     // smaller pieces to clarify its logic.
 
-    const auto chars = unicode::get_characters_info(text);
-
-    std::vector<int> scripts;
-
-    {
-      scripts.reserve(chars.size());
-      int previous_script = -1;
-      for (const auto& c : chars) {
-        const int script = unicode::get_script(c.value, previous_script);
-        scripts.emplace_back(script);
-        if (script != -1)
-          previous_script = script;
-      }
-    }
+    // Scripts are only used to segment on alphabets and to count alphabets.
+    const bool need_scripts = (alphabets != nullptr
+                               || policy.segment_alphabet_change()
+                               || policy.segment_alphabet());
+    CharStream chars(text, need_scripts, workspace._chars, workspace._scripts);
 
-    TokensBuilder builder(_options, annotated_tokens);
+    TokensBuilder builder(_options, annotated_tokens, lowercase_while_segmenting());
     State state = State::Space;
     int prev_alphabet = -1;
 
-    for (size_t i = 0; i < chars.size(); ++i)
+    for (size_t consumed = 1; chars.get(0); chars.advance(consumed), consumed = 1)
     {
-      const auto& c = chars[i];
+      // Copy the character as reading the next ones can invalidate the reference.
+      const unicode::CharInfo c = *chars.get(0);
       const unicode::code_point_t v = c.value;
       if (v < 32 || v == 0xFEFF)  // skip special characters and BOM
         continue;
 
-      const size_t next_index = get_next_main_char(chars, scripts, i, _options);
-      const auto* next_c = next_index < chars.size() ? &chars[next_index] : nullptr;
-      const bool has_combining_marks = (next_index != i + 1);
+      const size_t next_index = get_next_main_char(chars, c, policy);
+      const auto* next_c = chars.get(next_index);
+      const bool has_combining_marks = (next_index != 1);
 
       if (state == State::Placeholder)
       {
         if (v == ph_marker_close_cp)
         {
           builder.append(c);
-          if (_options.preserve_placeholders)
+          builder.end_placeholder();
+          if (policy.preserve_placeholders())
             builder.current().preserve = true;
           prev_alphabet = placeholder_alphabet;
           state = State::Letter;
@@ -845,6 +1335,7 @@ namespace onmt
             builder.previous().join_right = true;
         }
         builder.append(c);
+        builder.begin_placeholder();
         state = State::Placeholder;
       }
 
@@ -859,9 +1350,9 @@ namespace onmt
           }
 
           builder.escape_append(c);
-          builder.append(chars, i + 1, next_index);
+          builder.append(chars, 1, next_index);
           builder.segment();
-          i = next_index - 1;
+          consumed = next_index;
           state = State::Other;
         }
         else
@@ -869,7 +1360,7 @@ namespace onmt
           if (state != State::Space)
             builder.segment();
 
-          if (_options.with_separators)
+          if (policy.with_separators())
           {
             builder.append(c);
             if (!next_c || next_c->char_type != unicode::CharType::Separator)
@@ -880,7 +1371,7 @@ namespace onmt
         }
       }
 
-      else if (_options.support_prior_joiners && c == _options.joiner)
+      else if (policy.support_prior_joiners() && c == _options.joiner)
       {
         if (state == State::Other)
           builder.previous().join_right = true;
@@ -902,8 +1393,8 @@ namespace onmt
         int alphabet = -1;
         if (is_number)
           alphabet = number_alphabet;
-        else if (is_letter)
-          alphabet = scripts[i];
+        else if (is_letter && need_scripts)
+          alphabet = chars.script(0);
 
         if (alphabets != nullptr)
         {
@@ -915,7 +1406,7 @@ namespace onmt
           (*alphabets)[alphabet_name]++;
         }
 
-        if (_options.mode == Mode::Conservative)
+        if (policy.mode() == Mode::Conservative)
         {
           if (is_number
               || (c == '_')
@@ -931,7 +1422,7 @@ namespace onmt
           }
         }
 
-        if (is_letter && _options.mode != Mode::Char)
+        if (is_letter && policy.mode() != Mode::Char)
         {
           const Casing new_casing = update_casing(builder.current().casing,
                                                   c.case_type,
@@ -942,18 +1433,19 @@ namespace onmt
           bool segment_alphabet_change = false;
           if (state == State::Number
               || (state == State::Letter &&
-                  ((segment_alphabet = (prev_alphabet == alphabet
+                  ((segment_alphabet = (policy.segment_alphabet()
+                                        && prev_alphabet == alphabet
                                         && alphabet >= 0
                                         && (_options.segment_alphabet_codes.find(alphabet)
                                             != _options.segment_alphabet_codes.end())))
                    || (segment_alphabet_change = (prev_alphabet != alphabet
-                                                  && _options.segment_alphabet_change))
+                                                  && policy.segment_alphabet_change()))
                    || (prev_alphabet == placeholder_alphabet)
-                   || (_options.segment_case
+                   || (policy.segment_case()
                        && (segment_case = (new_casing == Casing::Mixed))))))
           {
             builder.current().join_right = true;
-            if (_options.preserve_segmented_tokens
+            if (policy.preserve_segmented_tokens()
                 && (segment_case || segment_alphabet || segment_alphabet_change))
               builder.current().preserve = true;
             builder.segment();
@@ -969,18 +1461,18 @@ namespace onmt
           builder.safe_append(c);
           if (has_combining_marks)
           {
-            builder.append(chars, i + 1, next_index);
-            i = next_index - 1;
+            builder.append(chars, 1, next_index);
+            consumed = next_index;
           }
           state = State::Letter;
           prev_alphabet = alphabet;
         }
-        else if (is_number && _options.mode != Mode::Char)
+        else if (is_number && policy.mode() != Mode::Char)
         {
-          const bool segment_number = (_options.segment_numbers && state == State::Number);
+          const bool segment_number = (policy.segment_numbers() && state == State::Number);
           if (state == State::Letter || segment_number)
           {
-            if (_options.preserve_segmented_tokens && segment_number)
+            if (policy.preserve_segmented_tokens() && segment_number)
               builder.current().preserve = true;
             builder.segment();
             if (state != State::Letter || prev_alphabet == placeholder_alphabet)
@@ -996,8 +1488,8 @@ namespace onmt
           builder.safe_append(c);
           if (has_combining_marks)
           {
-            builder.append(chars, i + 1, next_index);
-            i = next_index - 1;
+            builder.append(chars, 1, next_index);
+            consumed = next_index;
           }
           state = State::Number;
         }
@@ -1007,55 +1499,62 @@ namespace onmt
           {
             builder.segment();
             builder.current().join_left = true;
-            if (_options.preserve_segmented_tokens && c.char_type == unicode::CharType::Mark)
+            if (policy.preserve_segmented_tokens() && c.char_type == unicode::CharType::Mark)
               builder.current().preserve = true;
           }
 
           builder.safe_append(c);
           if (has_combining_marks)
           {
-            builder.append(chars, i + 1, next_index);
-            i = next_index - 1;
+            builder.append(chars, 1, next_index);
+            consumed = next_index;
           }
           builder.segment();
           state = State::Other;
         }
       }
     }
+
+    if (state == State::Placeholder)  // The placeholder is not closed.
+      builder.lowercase_current();
   }
 
-  static inline void add_final_token(std::vector<std::string>& tokens,
-                                     std::vector<std::vector<std::string>>& features,
-                                     bool case_feature,
-                                     std::string token,
-                                     Casing casing = Casing::None)
+  // Calls function(token, casing, case_feature) for each final token. The case feature is
+  // false for case markup tokens which do not have features. The token view is only valid
+  // during the call. buffer is used to concatenate joiners or spacers to the surfaces.
+  template <typename Function>
+  void Tokenizer::for_each_final_token(const std::vector<Token>& annotated_tokens,
+                                       std::string& buffer,
+                                       const Function& function) const
   {
-    if (token.empty())
-      return;
-    tokens.emplace_back(std::move(token));
-    if (case_feature)
-      features.back().emplace_back(1, casing_to_char(casing));
+    if (_kernel == Kernel::Generic)
+      for_each_final_token(annotated_tokens, buffer, function,
+                           RuntimeOptions(_options, !_options.segment_alphabet_codes.empty()));
+    else if (_options.joiner_annotate)
+      for_each_final_token(annotated_tokens, buffer, function,
+                           DefaultAnnotation<Annotation::Joiner>());
+    else if (_options.spacer_annotate)
+      for_each_final_token(annotated_tokens, buffer, function,
+                           DefaultAnnotation<Annotation::Spacer>());
+    else
+      for_each_final_token(annotated_tokens, buffer, function,
+                           DefaultAnnotation<Annotation::None>());
   }
 
-  void Tokenizer::finalize_tokens(const std::vector<Token>& annotated_tokens,
-                                  std::vector<std::string>& tokens,
-                                  std::vector<std::vector<std::string>>& features) const
+  template <typename Policy, typename Function>
+  void Tokenizer::for_each_final_token(const std::vector<Token>& annotated_tokens,
+                                       std::string& buffer,
+                                       const Function& function,
+                                       const Policy& policy) const
   {
-    tokens.reserve(annotated_tokens.size());
-    size_t num_features = 0;
-    if (annotated_tokens.size() > 0 && annotated_tokens[0].has_features())
-      num_features = annotated_tokens[0].features.size();
-    if (_options.case_feature)
-      num_features += 1;
-
-    for (size_t i = 0; i < num_features; ++i)
-    {
-      features.emplace_back(0);
-      features.back().reserve(annotated_tokens.size());
-    }
+    const auto add_final_token = [&function](std::string_view token,
+                                             Casing casing = Casing::None) {
+      if (!token.empty())
+        function(token, casing, true);
+    };
 
     std::vector<TokenCaseMarkup> case_markups;
-    if (_options.case_markup)
+    if (policy.case_markup())
       case_markups = get_case_markups(annotated_tokens, _options.soft_case_regions);
 
     for (size_t i = 0; i < annotated_tokens.size(); ++i)
@@ -1064,21 +1563,16 @@ namespace onmt
       const auto& str = token.surface;
       const auto casing = token.casing;
 
-      if (token.has_features())
-      {
-        const auto& token_features = token.features;
-        for (size_t j = 0; j < token_features.size(); ++j)
-          features[j].push_back(token_features[j]);
-      }
-
-      if (_options.case_markup && case_markups[i].prefix != CaseMarkupType::None)
-        tokens.emplace_back(write_case_markup(case_markups[i].prefix, case_markups[i].casing));
+      if (policy.case_markup() && case_markups[i].prefix != CaseMarkupType::None)
+        function(write_case_markup(case_markups[i].prefix, case_markups[i].casing),
+                 Casing::None,
+                 false);
 
       const std::string* prefix = nullptr;
       const std::string* suffix = nullptr;
       bool attach = !token.preserve;
 
-      if (_options.joiner_annotate)
+      if (policy.joiner_annotate())
       {
         if (token.join_left && i > 0)
           prefix = &_options.joiner;
@@ -1086,58 +1580,255 @@ namespace onmt
           suffix = &_options.joiner;
         if (token.spacer)
           attach = true;  // Ignore preserve flag for spacers in joiner mode.
-        attach = attach && !_options.joiner_new;
+        attach = attach && !policy.joiner_new();
       }
-      else if (_options.spacer_annotate)
+      else if (policy.spacer_annotate())
       {
         if ((i == 0 && token.spacer)
             || (i > 0 && !token.join_left && !annotated_tokens[i - 1].join_right))
-          prefix = &spacer_marker;
-        attach = attach && !_options.spacer_new;
+          prefix = &Tokenizer::spacer_marker;
+        attach = attach && !policy.spacer_new();
       }
 
       if (!prefix && !suffix)
-        add_final_token(tokens, features, _options.case_feature, str, casing);
+        add_final_token(str, casing);
       else if (attach)
       {
-        std::string final_token = (prefix ? *prefix : "") + str + (suffix ? *suffix : "");
-        add_final_token(tokens, features, _options.case_feature, std::move(final_token), casing);
+        buffer.clear();
+        if (prefix)
+          buffer += *prefix;
+        buffer += str;
+        if (suffix)
+          buffer += *suffix;
+        add_final_token(buffer, casing);
       }
       else
       {
         if (prefix)
-          add_final_token(tokens, features, _options.case_feature, *prefix);
-        add_final_token(tokens, features, _options.case_feature, str, casing);
+          add_final_token(*prefix);
+        add_final_token(str, casing);
         if (suffix)
-          add_final_token(tokens, features, _options.case_feature, *suffix);
+          add_final_token(*suffix);
       }
 
-      if (_options.case_markup && case_markups[i].suffix != CaseMarkupType::None)
-        tokens.emplace_back(write_case_markup(case_markups[i].suffix, case_markups[i].casing));
+      if (policy.case_markup() && case_markups[i].suffix != CaseMarkupType::None)
+        function(write_case_markup(case_markups[i].suffix, case_markups[i].casing),
+                 Casing::None,
+                 false);
     }
   }
 
+  void Tokenizer::finalize_tokens(const std::vector<Token>& annotated_tokens,
+                                  std::vector<std::string>& tokens,
+                                  std::vector<std::vector<std::string>>& features) const
+  {
+    tokens.reserve(annotated_tokens.size());
+    size_t num_features = 0;
+    if (annotated_tokens.size() > 0 && annotated_tokens[0].has_features())
+      num_features = annotated_tokens[0].features.size();
+    if (_options.case_feature)
+      num_features += 1;
+
+    for (size_t i = 0; i < num_features; ++i)
+    {
+      features.emplace_back(0);
+      features.back().reserve(annotated_tokens.size());
+    }
+
+    for (const auto& token : annotated_tokens)
+    {
+      if (token.has_features())
+      {
+        const auto& token_features = token.features;
+        for (size_t j = 0; j < token_features.size(); ++j)
+          features[j].push_back(token_features[j]);
+      }
+    }
+
+    std::string buffer;
+    for_each_final_token(annotated_tokens,
+                         buffer,
+                         [&](std::string_view token, Casing casing, bool case_feature) {
+                           tokens.emplace_back(token);
+                           if (case_feature && _options.case_feature)
+                             features.back().emplace_back(1, casing_to_char(casing));
+                         });
+  }
+
+  void Tokenizer::finalize_tokens(const std::vector<Token>& annotated_tokens,
+                                  std::string& output,
+                                  const std::string& tokens_delimiter) const
+  {
+    std::string buffer;
+    finalize_tokens(annotated_tokens, output, tokens_delimiter, buffer);
+  }
+
+  void Tokenizer::finalize_tokens(const std::vector<Token>& annotated_tokens,
+                                  std::string& output,
+                                  const std::string& tokens_delimiter,
+                                  std::string& buffer) const
+  {
+    // Features from the input are rare: use the vectors in this case.
+    if (!annotated_tokens.empty() && annotated_tokens[0].has_features())
+    {
+      std::vector<std::string> tokens;
+      std::vector<std::vector<std::string>> features;
+      finalize_tokens(annotated_tokens, tokens, features);
+      output += write_tokens(tokens, features, tokens_delimiter);
+      return;
+    }
+
+    bool first = true;
+    for_each_final_token(annotated_tokens,
+                         buffer,
+                         [&](std::string_view token, Casing casing, bool case_feature) {
+                           if (!first)
+                             output += tokens_delimiter;
+                           first = false;
+                           output += token;
+                           if (case_feature && _options.case_feature)
+                           {
+                             output += ITokenizer::feature_marker;
+                             output += casing_to_char(casing);
+                           }
+                         });
+  }
+
+  static inline size_t lookup_id(const Vocab& vocab, std::string_view token, std::string& key)
+  {
+    // Vocab only supports lookups with std::string.
+    key.assign(token.data(), token.size());
+    return vocab.lookup(key);
+  }
+
+  static inline size_t lookup_id(const FrozenVocab& vocab, std::string_view token, std::string&)
+  {
+    return vocab.lookup(token);
+  }
+
+  template <typename VocabType>
+  void Tokenizer::tokenize_to_ids(const std::string& text,
+                                  const VocabType& vocab,
+                                  std::vector<int32_t>& ids,
+                                  TokenizationWorkspace& workspace,
+                                  bool training) const
+  {
+    auto& annotated_tokens = workspace._tokens;
+    annotated_tokens.clear();
+    tokenize(text, annotated_tokens, nullptr, workspace, training);
+
+    ids.reserve(ids.size() + annotated_tokens.size());
+    for_each_final_token(annotated_tokens,
+                         workspace._token_buffer,
+                         [&](std::string_view token, Casing, bool) {
+                           const size_t id = lookup_id(vocab, token, workspace._lookup_key);
+                           ids.emplace_back(static_cast<int32_t>(id));
+                         });
+  }
+
+  template <typename VocabType>
+  void Tokenizer::tokenize_batch_to_ids(const std::vector<std::string>& texts,
+                                        const VocabType& vocab,
+                                        std::vector<int32_t>& ids,
+                                        std::vector<size_t>& lengths,
+                                        int32_t padding_id,
+                                        size_t num_threads,
+                                        bool training) const
+  {
+    std::vector<std::vector<int32_t>> batch_ids(texts.size());
+    ThreadPool::get_shared().parallel_for(texts.size(), num_threads, [&](size_t i) {
+      tokenize_to_ids(texts[i], vocab, batch_ids[i], training);
+    });
+
+    size_t max_length = 0;
+    lengths.resize(texts.size());
+    for (size_t i = 0; i < texts.size(); ++i)
+    {
+      lengths[i] = batch_ids[i].size();
+      max_length = std::max(max_length, lengths[i]);
+    }
+
+    ids.assign(texts.size() * max_length, padding_id);
+    for (size_t i = 0; i < texts.size(); ++i)
+      std::copy(batch_ids[i].begin(), batch_ids[i].end(), ids.begin() + i * max_length);
+  }
+
+  void Tokenizer::tokenize_to_ids(const std::string& text,
+                                  const Vocab& vocab,
+                                  std::vector<int32_t>& ids,
+                                  bool training) const
+  {
+    with_thread_workspace(text, [&](TokenizationWorkspace& workspace) {
+      tokenize_to_ids(text, vocab, ids, workspace, training);
+    });
+  }
+
+  void Tokenizer::tokenize_to_ids(const std::string& text,
+                                  const FrozenVocab& vocab,
+                                  std::vector<int32_t>& ids,
+                                  bool training) const
+  {
+    with_thread_workspace(text, [&](TokenizationWorkspace& workspace) {
+      tokenize_to_ids(text, vocab, ids, workspace, training);
+    });
+  }
+
+  void Tokenizer::tokenize_batch_to_ids(const std::vector<std::string>& texts,
+                                        const Vocab& vocab,
+                                        std::vector<int32_t>& ids,
+                                        std::vector<size_t>& lengths,
+                                        int32_t padding_id,
+                                        size_t num_threads,
+                                        bool training) const
+  {
+    tokenize_batch_to_ids<Vocab>(texts, vocab, ids, lengths, padding_id, num_threads, training);
+  }
+
+  void Tokenizer::tokenize_batch_to_ids(const std::vector<std::string>& texts,
+                                        const FrozenVocab& vocab,
+                                        std::vector<int32_t>& ids,
+                                        std::vector<size_t>& lengths,
+                                        int32_t padding_id,
+                                        size_t num_threads,
+                                        bool training) const
+  {
+    tokenize_batch_to_ids<FrozenVocab>(texts,
+                                       vocab,
+                                       ids,
+                                       lengths,
+                                       padding_id,
+                                       num_threads,
+                                       training);
+  }
+
   Tokenizer& Tokenizer::set_joiner(const std::string& joiner)
   {
     _options.joiner = joiner;
+    select_kernel();
     return *this;
   }
 
   void Tokenizer::unset_annotate()
   {
     _options.joiner_annotate = _options.spacer_annotate = false;
+    select_kernel();
   }
 
   void Tokenizer::set_subword_encoder(const std::shared_ptr<const SubwordEncoder>& subword_encoder)
   {
     _subword_encoder = subword_encoder;
     if (_subword_encoder)
+    {
       _subword_encoder->update_tokenization_options(_options);
+      select_kernel();
+    }
   }
 
   bool Tokenizer::add_alphabet_to_segment(const std::string& alphabet)
   {
-    return _options.add_alphabet_to_segment(alphabet);
+    const bool added = _options.add_alphabet_to_segment(alphabet);
+    select_kernel();  // Segmenting alphabets is not supported by the specialized kernels.
+    return added;
   }
 
   bool Tokenizer::is_placeholder(const std::string& str)
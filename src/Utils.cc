@@ -49,13 +49,13 @@ namespace onmt
     return parts;
   }
 
-  bool is_placeholder(const std::string& str)
+  bool is_placeholder(std::string_view str)
   {
     size_t ph_begin = str.find(Tokenizer::ph_marker_open);
-    if (ph_begin == std::string::npos)
+    if (ph_begin == std::string_view::npos)
       return false;
     size_t min_ph_end = ph_begin + Tokenizer::ph_marker_open.length() + 1;
-    return str.find(Tokenizer::ph_marker_close, min_ph_end) != std::string::npos;
+    return str.find(Tokenizer::ph_marker_close, min_ph_end) != std::string_view::npos;
   }
 
   constexpr unsigned int default_seed = static_cast<unsigned int>(-1);
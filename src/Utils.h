@@ -1,6 +1,8 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 
 namespace onmt
@@ -13,7 +15,7 @@ namespace onmt
                                         const std::string& separator,
                                         bool skip_empty = true);
 
-  bool is_placeholder(const std::string& str);
+  bool is_placeholder(std::string_view str);
 
   void set_random_generator_seed(const unsigned int seed);
   unsigned int get_random_generator_seed();
@@ -21,4 +23,97 @@ namespace onmt
   std::string int_to_hex(int i, int width = 4);
   int hex_to_int(const std::string& str);
 
+  // Helpers for the open addressing tables that are saved in binary files.
+
+  // FNV-1a hash.
+  inline uint64_t hash_string(std::string_view str)
+  {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char c : str)
+    {
+      hash ^= static_cast<unsigned char>(c);
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  // Returns a power of two so that the table is at most half full.
+  inline size_t get_table_size(size_t num_entries)
+  {
+    size_t size = 1;
+    while (size < num_entries * 2)
+      size <<= 1;
+    return size;
+  }
+
+  inline bool is_power_of_two(size_t size)
+  {
+    return size > 0 && (size & (size - 1)) == 0;
+  }
+
+  // Returns true if the table only contains empty slots (-1) or IDs lower than num_ids, and
+  // has at least one empty slot so that the probing of missing keys ends.
+  inline bool is_valid_ids_table(const int32_t* table, size_t table_size, size_t num_ids)
+  {
+    bool has_empty_slot = false;
+    for (size_t i = 0; i < table_size; ++i)
+    {
+      if (table[i] == -1)
+        has_empty_slot = true;
+      else if (table[i] < 0 || static_cast<size_t>(table[i]) >= num_ids)
+        return false;
+    }
+    return has_empty_slot;
+  }
+
+  // Binary files start with a header followed by sections aligned on 8 bytes. The sizes
+  // read from a file can not be trusted: when the layout overflows, its size is 0.
+  class SectionsLayout
+  {
+  public:
+    SectionsLayout(size_t header_size)
+      : _size(header_size)
+    {
+    }
+
+    // Returns the offset of a section of num_elements elements of element_size bytes.
+    size_t add_section(uint64_t num_elements, size_t element_size)
+    {
+      static constexpr size_t max_size = static_cast<size_t>(-1) - 7;
+      const size_t offset = _size;
+      if (num_elements > max_size / element_size)
+        _overflow = true;
+      else
+      {
+        const size_t section_size = (num_elements * element_size + 7) & ~static_cast<size_t>(7);
+        if (section_size > max_size - _size)
+          _overflow = true;
+        else
+          _size += section_size;
+      }
+      return offset;
+    }
+
+    size_t size() const
+    {
+      return _overflow ? 0 : _size;
+    }
+
+  private:
+    size_t _size;
+    bool _overflow = false;
+  };
+
+  // Returns true if the num_items + 1 offsets are increasing and the last one is data_size,
+  // so that each item is in the data section.
+  inline bool is_valid_offsets(const uint32_t* offsets, size_t num_items, uint64_t data_size)
+  {
+    for (size_t i = 0; i < num_items; ++i)
+    {
+      if (offsets[i] > offsets[i + 1])
+        return false;
+    }
+    return offsets[num_items] == data_size;
+  }
+
 }
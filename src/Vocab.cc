@@ -1,8 +1,12 @@
 #include "onmt/Vocab.h"
 
 #include <algorithm>
+#include <cstring>
+#include <fstream>
 #include <numeric>
 
+#include "MappedFile.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 
 namespace onmt
@@ -51,11 +55,62 @@ namespace onmt
       add_token(std::move(token));
   }
 
-  void Vocab::add_from_stream(std::istream& is, const Tokenizer* tokenizer)
+  void Vocab::add_from_stream(std::istream& is, const Tokenizer* tokenizer, size_t num_threads)
   {
     std::string line;
+    if (num_threads <= 1)
+    {
+      while (std::getline(is, line))
+        add_from_text(line, tokenizer);
+      return;
+    }
+
+    static constexpr size_t batch_size = 10000;
+    std::vector<std::string> lines;
+    lines.reserve(batch_size);
+
+    const auto add_batch = [&]() {
+      const size_t num_ranges = get_num_ranges(lines.size(), num_threads, 1);
+      std::vector<Vocab> partial_vocabs(num_ranges);
+      ThreadPool::get_shared().parallel_for(num_ranges, num_ranges, [&](size_t r) {
+        const auto range = get_range(lines.size(), num_ranges, r);
+        for (size_t i = range.first; i < range.second; ++i)
+          partial_vocabs[r].add_from_text(lines[i], tokenizer);
+      });
+
+      for (const auto& partial_vocab : partial_vocabs)
+        merge(partial_vocab);
+      lines.clear();
+    };
+
     while (std::getline(is, line))
-      add_from_text(line, tokenizer);
+    {
+      lines.emplace_back(std::move(line));
+      if (lines.size() == batch_size)
+        add_batch();
+    }
+
+    if (!lines.empty())
+      add_batch();
+  }
+
+  void Vocab::add_from_files(const std::vector<std::string>& paths,
+                             const Tokenizer* tokenizer,
+                             size_t num_threads)
+  {
+    for (const auto& path : paths)
+    {
+      std::ifstream in(path);
+      if (!in)
+        throw std::invalid_argument("Failed to open input file " + path);
+      add_from_stream(in, tokenizer, num_threads);
+    }
+  }
+
+  void Vocab::merge(const Vocab& other)
+  {
+    for (size_t id = 0; id < other.size(); ++id)
+      add_token(other._ids_to_tokens[id], other._frequencies[id]);
   }
 
   void Vocab::resize(size_t maximum_size, size_t minimum_frequency)
@@ -102,4 +157,187 @@ namespace onmt
     _frequencies = std::move(new_frequencies);
   }
 
+
+  // Frozen vocabularies start with a header followed by these sections, each aligned on
+  // 8 bytes: tokens offset, tokens data, tokens table, and frequencies. Integers use the
+  // native byte order.
+  static constexpr char frozen_vocab_magic[8] = {'O', 'N', 'M', 'T', 'V', 'O', 'C', '\0'};
+  static constexpr uint32_t frozen_vocab_format_version = 1;
+  static constexpr uint32_t frozen_vocab_byte_order = 0x01020304;
+
+  struct FrozenVocabHeader
+  {
+    char magic[8];
+    uint32_t format_version;
+    uint32_t byte_order;
+    uint64_t num_tokens;
+    uint64_t tokens_data_size;
+    uint64_t table_size;
+    uint64_t default_id;
+  };
+
+  struct FrozenVocabLayout
+  {
+    size_t tokens_offset;
+    size_t tokens_data;
+    size_t table;
+    size_t frequencies;
+    size_t size;
+
+    FrozenVocabLayout(const FrozenVocabHeader& header)
+    {
+      // Larger numbers of tokens are invalid. They are clamped so that num_tokens + 1 does
+      // not overflow.
+      const uint64_t num_tokens = std::min(header.num_tokens,
+                                           uint64_t(std::numeric_limits<int32_t>::max()) + 1);
+      SectionsLayout layout(sizeof (FrozenVocabHeader));
+      tokens_offset = layout.add_section(num_tokens + 1, sizeof (uint32_t));
+      tokens_data = layout.add_section(header.tokens_data_size, 1);
+      table = layout.add_section(header.table_size, sizeof (int32_t));
+      frequencies = layout.add_section(num_tokens, sizeof (uint64_t));
+      size = layout.size();
+    }
+  };
+
+  FrozenVocab::FrozenVocab(const Vocab& vocab)
+  {
+    const auto& tokens = vocab.ids_to_tokens();
+    if (tokens.size() > size_t(std::numeric_limits<int32_t>::max()))
+      throw std::invalid_argument("The vocabulary has too many tokens to be frozen");
+
+    std::string tokens_data;
+    std::vector<uint32_t> tokens_offset;
+    tokens_offset.reserve(tokens.size() + 1);
+    tokens_offset.emplace_back(0);
+    for (const auto& token : tokens)
+    {
+      tokens_data.append(token);
+      if (tokens_data.size() > std::numeric_limits<uint32_t>::max())
+        throw std::invalid_argument("The vocabulary tokens are too large to be frozen");
+      tokens_offset.emplace_back(tokens_data.size());
+    }
+
+    std::vector<int32_t> table(get_table_size(tokens.size()), -1);
+    const size_t mask = table.size() - 1;
+    for (size_t id = 0; id < tokens.size(); ++id)
+    {
+      size_t slot = hash_string(tokens[id]) & mask;
+      while (table[slot] >= 0)
+        slot = (slot + 1) & mask;
+      table[slot] = id;
+    }
+
+    FrozenVocabHeader header;
+    std::memcpy(header.magic, frozen_vocab_magic, sizeof (frozen_vocab_magic));
+    header.format_version = frozen_vocab_format_version;
+    header.byte_order = frozen_vocab_byte_order;
+    header.num_tokens = tokens.size();
+    header.tokens_data_size = tokens_data.size();
+    header.table_size = table.size();
+    header.default_id = vocab.get_default_id();
+
+    const FrozenVocabLayout layout(header);
+    auto buffer = std::make_shared<std::vector<uint64_t>>(layout.size / sizeof (uint64_t), 0);
+    char* data = reinterpret_cast<char*>(buffer->data());
+    const auto copy_section = [data](size_t offset, const void* section, size_t size) {
+      if (size > 0)
+        std::memcpy(data + offset, section, size);
+    };
+
+    copy_section(0, &header, sizeof (header));
+    copy_section(layout.tokens_offset,
+                 tokens_offset.data(), tokens_offset.size() * sizeof (uint32_t));
+    copy_section(layout.tokens_data, tokens_data.data(), tokens_data.size());
+    copy_section(layout.table, table.data(), table.size() * sizeof (int32_t));
+    const std::vector<uint64_t> frequencies(vocab.counters().begin(), vocab.counters().end());
+    copy_section(layout.frequencies, frequencies.data(), frequencies.size() * sizeof (uint64_t));
+
+    init(std::move(buffer), data, layout.size);
+  }
+
+  FrozenVocab::FrozenVocab(const std::string& path)
+  {
+    auto file = std::make_shared<const MappedFile>(path);
+    const char* data = file->data();
+    const size_t size = file->size();
+    init(std::move(file), data, size);
+  }
+
+  void FrozenVocab::init(std::shared_ptr<const void> storage, const char* data, size_t size)
+  {
+    if (size < sizeof (FrozenVocabHeader))
+      throw std::invalid_argument("Invalid frozen vocabulary");
+
+    const auto* header = reinterpret_cast<const FrozenVocabHeader*>(data);
+    if (std::memcmp(header->magic, frozen_vocab_magic, sizeof (frozen_vocab_magic)) != 0)
+      throw std::invalid_argument("Invalid frozen vocabulary");
+    if (header->byte_order != frozen_vocab_byte_order)
+      throw std::invalid_argument("The frozen vocabulary was saved with a different byte order");
+    if (header->format_version != frozen_vocab_format_version)
+      throw std::invalid_argument("Unsupported frozen vocabulary version");
+
+    const FrozenVocabLayout layout(*header);
+    if (layout.size != size
+        || header->num_tokens > uint64_t(std::numeric_limits<int32_t>::max())
+        || !is_power_of_two(header->table_size))
+      throw std::invalid_argument("Invalid frozen vocabulary");
+
+    _storage = std::move(storage);
+    _data = data;
+    _data_size = size;
+    _size = header->num_tokens;
+    _default_id = header->default_id;
+    _table_size = header->table_size;
+    _tokens_offset = reinterpret_cast<const uint32_t*>(data + layout.tokens_offset);
+    _tokens_data = data + layout.tokens_data;
+    _table = reinterpret_cast<const int32_t*>(data + layout.table);
+    _frequencies = reinterpret_cast<const uint64_t*>(data + layout.frequencies);
+
+    if (!is_valid_offsets(_tokens_offset, _size, header->tokens_data_size)
+        || !is_valid_ids_table(_table, _table_size, _size))
+      throw std::invalid_argument("Invalid frozen vocabulary");
+  }
+
+  void FrozenVocab::save(const std::string& path) const
+  {
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+      throw std::invalid_argument("Failed to open vocabulary path " + path);
+    out.write(_data, _data_size);
+    if (!out)
+      throw std::runtime_error("Failed to write the frozen vocabulary to " + path);
+  }
+
+  size_t FrozenVocab::find(std::string_view token) const
+  {
+    const size_t mask = _table_size - 1;
+    for (size_t slot = hash_string(token) & mask;; slot = (slot + 1) & mask)
+    {
+      const int32_t id = _table[slot];
+      if (id < 0)
+        return _size;
+      if (lookup(static_cast<size_t>(id)) == token)
+        return id;
+    }
+  }
+
+  size_t FrozenVocab::lookup(std::string_view token) const
+  {
+    const size_t id = find(token);
+    return id < _size ? id : _default_id;
+  }
+
+  std::string_view FrozenVocab::lookup(size_t id) const
+  {
+    if (id >= _size)
+      return Vocab::unk_token;
+    return std::string_view(_tokens_data + _tokens_offset[id],
+                            _tokens_offset[id + 1] - _tokens_offset[id]);
+  }
+
+  bool FrozenVocab::contains(std::string_view token) const
+  {
+    return find(token) < _size;
+  }
+
 }
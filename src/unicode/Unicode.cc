@@ -1,7 +1,11 @@
 #include "onmt/unicode/Unicode.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <cstring>
+#include <memory>
 
 #include <unicode/locid.h>
 #include <unicode/uchar.h>
@@ -174,8 +178,40 @@ namespace onmt
       }
     }
 
+    struct CharProperties
+    {
+      CharType char_type;
+      CaseType case_type;
+    };
+
+    // The properties of the 1 and 2 bytes UTF-8 characters (e.g. ASCII, Latin, Greek,
+    // Cyrillic, Arabic) are read from a table that is built once from ICU.
+    static constexpr code_point_t properties_table_size = 0x800;
+    using PropertiesTable = std::array<CharProperties, properties_table_size>;
+
+    static const PropertiesTable& get_properties_table()
+    {
+      static const PropertiesTable table = []() {
+        PropertiesTable properties;
+        for (code_point_t u = 0; u < properties_table_size; ++u)
+        {
+          const auto category = u_charType(u);
+          properties[u] = CharProperties{get_char_type(category), get_case_type(category)};
+        }
+        return properties;
+      }();
+      return table;
+    }
+
+    static inline bool in_properties_table(code_point_t u)
+    {
+      return u >= 0 && u < properties_table_size;
+    }
+
     CharType get_char_type(code_point_t u)
     {
+      if (in_properties_table(u))
+        return get_properties_table()[u].char_type;
       return get_char_type(u_charType(u));
     }
 
@@ -201,6 +237,8 @@ namespace onmt
 
     CaseType get_case_v2(code_point_t u)
     {
+      if (in_properties_table(u))
+        return get_properties_table()[u].case_type;
       return get_case_type(u_charType(u));
     }
 
@@ -214,22 +252,107 @@ namespace onmt
       return u_toupper(u);
     }
 
+    // Returns true if the 8 bytes are in the range [0x01, 0x7F]. Bytes equal to 0 set
+    // the high bit when subtracting 1, and may also set it in the next bytes. This can
+    // only reject some ASCII words, which are then processed byte per byte.
+    static inline bool is_ascii_word(uint64_t word)
+    {
+      return ((word | (word - 0x0101010101010101ULL)) & 0x8080808080808080ULL) == 0;
+    }
+
     std::vector<CharInfo> get_characters_info(const std::string& str)
     {
       std::vector<CharInfo> chars;
+      get_characters_info(str, chars);
+      return chars;
+    }
+
+    void get_characters_info(const std::string& str, std::vector<CharInfo>& chars)
+    {
+      chars.clear();
       chars.reserve(str.size());
+      const char* data = str.c_str();
+      get_characters_info(data, data + str.size(), str.size(), chars);
+    }
 
-      character_iterator(
-        str,
-        [&chars](const char* data, size_t length, code_point_t code_point)
+    const char* get_characters_info(const char* data,
+                                    const char* end,
+                                    size_t max_chars,
+                                    std::vector<CharInfo>& chars)
+    {
+      const PropertiesTable& properties = get_properties_table();
+      const auto add_char = [&chars, &properties](const char* data,
+                                                  size_t length,
+                                                  code_point_t code_point) {
+        const auto& char_properties = properties[code_point];
+        chars.emplace_back(data,
+                           length,
+                           code_point,
+                           char_properties.char_type,
+                           char_properties.case_type);
+      };
+
+      // Same iteration as character_iterator, with fast paths for 1 and 2 bytes characters.
+      const size_t max_size = chars.size() + max_chars;
+      while (data < end && chars.size() < max_size)
+      {
+        uint64_t word;
+        size_t num_words = (max_size - chars.size()) / 8;
+        while (num_words > 0
+               && end - data >= 8
+               && (std::memcpy(&word, data, 8), is_ascii_word(word)))
+        {
+          for (size_t i = 0; i < 8; ++i)
+            add_char(data + i, 1, data[i]);
+          data += 8;
+          num_words--;
+        }
+
+        if (data == end || chars.size() == max_size)
+          break;
+
+        const auto lead = static_cast<unsigned char>(data[0]);
+        if (lead == 0)
+          return end;
+
+        if (lead < 0x80)
+        {
+          add_char(data, 1, lead);
+          data += 1;
+          continue;
+        }
+
+        if (lead >= 0xC2 && lead <= 0xDF && (static_cast<unsigned char>(data[1]) & 0xC0) == 0x80)
+        {
+          add_char(data, 2, ((lead & 0x1F) << 6) | (static_cast<unsigned char>(data[1]) & 0x3F));
+          data += 2;
+          continue;
+        }
+
+        size_t length = 0;
+        const code_point_t code_point = utf8_to_cp(data, &length);
+
+        if (code_point == 0)  // Ignore invalid code points.
+        {
+          data++;
+          continue;
+        }
+
+        if (in_properties_table(code_point))
+          add_char(data, length, code_point);
+        else
         {
           const auto category = u_charType(code_point);
-          const auto char_type = get_char_type(category);
-          const auto case_type = get_case_type(category);
-          chars.emplace_back(data, length, code_point, char_type, case_type);
-        });
+          chars.emplace_back(data,
+                             length,
+                             code_point,
+                             get_char_type(category),
+                             get_case_type(category));
+        }
+        data += length;
+      }
 
-      return chars;
+      return data;
     }
 
     bool support_language_rules()
@@ -275,7 +398,27 @@ namespace onmt
       return uscript_getName(static_cast<UScriptCode>(script_code));
     }
 
-    int get_script(code_point_t c, int previous_script)
+    // Scripts are read from a two-level table: code points are grouped in blocks of 256
+    // that are built from ICU the first time one of their code points is looked up.
+    static constexpr code_point_t max_code_point = 0x10FFFF;
+    static constexpr int script_block_bits = 8;
+    static constexpr code_point_t script_block_size = 1 << script_block_bits;
+    static constexpr size_t num_script_blocks = (max_code_point >> script_block_bits) + 1;
+
+    struct ScriptExtensions
+    {
+      std::bitset<USCRIPT_CODE_LIMIT> scripts;
+      int first;
+    };
+
+    struct ScriptBlock
+    {
+      std::array<int16_t, script_block_size> scripts;
+      std::array<uint16_t, script_block_size> extensions_index;  // For common characters.
+      std::vector<ScriptExtensions> extensions;
+    };
+
+    static int get_compat_script(code_point_t c)
     {
       for (const auto& pair : compat_scripts)
       {
@@ -283,11 +426,83 @@ namespace onmt
         if (c >= range.first && c <= range.second)
           return pair.first.second;
       }
+      return -1;
+    }
 
-      UErrorCode error = U_ZERO_ERROR;
-      UScriptCode code = uscript_getScript(c, &error);
+    static std::unique_ptr<ScriptBlock> build_script_block(code_point_t first_code_point)
+    {
+      auto block = std::make_unique<ScriptBlock>();
 
-      switch (code)
+      for (code_point_t i = 0; i < script_block_size; ++i)
+      {
+        const code_point_t c = first_code_point + i;
+        int script = get_compat_script(c);
+        uint16_t extensions_index = 0;
+
+        if (script < 0)
+        {
+          UErrorCode error = U_ZERO_ERROR;
+          script = uscript_getScript(c, &error);
+
+          if (script == USCRIPT_COMMON)
+          {
+            UScriptCode codes[USCRIPT_CODE_LIMIT];
+            const int num_codes = uscript_getScriptExtensions(c, codes, USCRIPT_CODE_LIMIT, &error);
+            ScriptExtensions extensions;
+            extensions.first = codes[0];
+            for (int j = 0; j < num_codes; ++j)
+              extensions.scripts.set(codes[j]);
+
+            const auto it = std::find_if(block->extensions.begin(),
+                                         block->extensions.end(),
+                                         [&extensions](const ScriptExtensions& other) {
+                                           return (other.first == extensions.first
+                                                   && other.scripts == extensions.scripts);
+                                         });
+            extensions_index = it - block->extensions.begin();
+            if (it == block->extensions.end())
+              block->extensions.emplace_back(std::move(extensions));
+          }
+        }
+
+        block->scripts[i] = script;
+        block->extensions_index[i] = extensions_index;
+      }
+
+      return block;
+    }
+
+    static const ScriptBlock& get_script_block(code_point_t c)
+    {
+      // Blocks are never released.
+      static std::array<std::atomic<const ScriptBlock*>, num_script_blocks> blocks;
+
+      auto& slot = blocks[c >> script_block_bits];
+      const ScriptBlock* block = slot.load(std::memory_order_acquire);
+      if (!block)
+      {
+        auto new_block = build_script_block(c & ~(script_block_size - 1));
+        // Another thread may have built the same block in the meantime.
+        if (slot.compare_exchange_strong(block,
+                                         new_block.get(),
+                                         std::memory_order_acq_rel,
+                                         std::memory_order_acquire))
+          block = new_block.release();
+      }
+
+      return *block;
+    }
+
+    int get_script(code_point_t c, int previous_script)
+    {
+      if (c < 0 || c > max_code_point)
+        return USCRIPT_INVALID_CODE;
+
+      const ScriptBlock& block = get_script_block(c);
+      const size_t index = c & (script_block_size - 1);
+      const int script = block.scripts[index];
+
+      switch (script)
       {
       case USCRIPT_INHERITED:
         return previous_script;
@@ -295,17 +510,15 @@ namespace onmt
       {
         // For common characters, we return previous_script if it is included in
         // their script extensions.
-        UScriptCode extensions[USCRIPT_CODE_LIMIT];
-        int num_extensions = uscript_getScriptExtensions(c, extensions, USCRIPT_CODE_LIMIT, &error);
-        for (int i = 0; i < num_extensions; ++i)
-        {
-          if (extensions[i] == previous_script)
-            return previous_script;
-        }
-        return extensions[0];
+        const auto& extensions = block.extensions[block.extensions_index[index]];
+        if (previous_script >= 0
+            && previous_script < USCRIPT_CODE_LIMIT
+            && extensions.scripts.test(previous_script))
+          return previous_script;
+        return extensions.first;
       }
       default:
-        return code;
+        return script;
       }
     }
 
@@ -1,14 +1,59 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <thread>
+
 #include <gtest/gtest.h>
 
 #include <onmt/BPE.h>
+#include <onmt/BPELearner.h>
 #include <onmt/SentencePiece.h>
+#include <onmt/SentencePieceLearner.h>
 #include <onmt/Tokenizer.h>
+#include <onmt/Vocab.h>
 
+#include <sentencepiece_processor.h>
+#include <sentencepiece_trainer.h>
 #include <unicode/unistr.h>
 #include <unicode/normalizer2.h>
 
 using namespace onmt;
 
+// Count memory allocations to check that some code paths do not allocate.
+static std::atomic<size_t> num_allocations(0);
+
+#if defined(__GNUC__) && !defined(__clang__)
+#  pragma GCC diagnostic push
+#  pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void* operator new(std::size_t size) {
+  ++num_allocations;
+  void* ptr = std::malloc(size == 0 ? 1 : size);
+  if (!ptr)
+    throw std::bad_alloc();
+  return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+  std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  std::free(ptr);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#  pragma GCC diagnostic pop
+#endif
+
 static std::string normalize_nfc(const std::string& s) {
   UErrorCode error = U_ZERO_ERROR;
   const auto* norm = icu::Normalizer2::getNFCInstance(error);
@@ -30,6 +75,47 @@ static std::string get_data(const std::string& path) {
   return data_dir + "/" + path;
 }
 
+// Path in the temporary directory that is unique to the current test and process. The
+// file is removed when the object is destroyed, even if the test fails.
+class TemporaryFile {
+public:
+  explicit TemporaryFile(const std::string& name)
+    : _path(make_path(name))
+  {
+  }
+
+  // Same path as prefix with a suffix, e.g. for files created from a prefix.
+  TemporaryFile(const TemporaryFile& prefix, const std::string& suffix)
+    : _path(prefix.path() + suffix)
+  {
+  }
+
+  TemporaryFile(const TemporaryFile&) = delete;
+  TemporaryFile& operator=(const TemporaryFile&) = delete;
+
+  ~TemporaryFile() {
+    std::remove(_path.c_str());
+  }
+
+  const std::string& path() const {
+    return _path;
+  }
+
+private:
+  const std::string _path;
+
+  static std::string make_path(const std::string& name) {
+    static const std::string process_id = std::to_string(std::random_device()());
+    static std::atomic<size_t> counter(0);
+    const auto* test_info = ::testing::UnitTest::GetInstance()->current_test_info();
+    return (::testing::TempDir()
+            + "onmt_" + (test_info ? test_info->name() : "test")
+            + "_" + process_id
+            + "_" + std::to_string(counter++)
+            + "_" + name);
+  }
+};
+
 static void test_tok(const Tokenizer& tokenizer,
                      const std::string& in,
                      const std::string& expected,
@@ -726,6 +812,68 @@ TEST(TokenizerTest, CaseMarkupWithLocaleNl) {
   test_detok(options, "｟mrk_case_modifier_C｠ ijssel", "IJssel");
 }
 
+TEST(TokenizerTest, CaseMarkupWithLocaleTr) {
+  Tokenizer::Options options;
+  options.case_markup = true;
+  options.lang = "tr";
+  test_tok(options, "Iğdır İzmir", "｟mrk_case_modifier_C｠ ığdır ｟mrk_case_modifier_C｠ izmir");
+  test_detok(options, "｟mrk_case_modifier_C｠ istanbul", "İstanbul");
+  // The ICU locale is cached per language.
+  options.lang = "en";
+  test_tok(options, "Iğdır İzmir", "｟mrk_case_modifier_C｠ iğdır ｟mrk_case_modifier_C｠ i̇zmir");
+  test_detok(options, "｟mrk_case_modifier_C｠ istanbul", "Istanbul");
+}
+
+TEST(TokenizerTest, LowercaseWhileSegmenting) {
+  // Tokens are lowercased during the segmentation unless a language is set, in which case
+  // they are lowercased after the segmentation. Both paths should produce the same tokens
+  // when the language has no specific rules for these characters.
+  const std::vector<std::string> pieces = {
+    "a", "B", "é", "É", "ß", "Ж", "ж", "中", "カ", "ب", "\xCC\x81", "\xE0\xA4\x95",
+    " ", "\t", "\xC2\xA0", "0", "٣", "-", "_", ".", ",", "'", "％", "￭", "■", "▁",
+    "｟", "｠", "｟Ph｠", "｟A B｠", "\xEF\xBB\xBF", "\xFF", "😀", "Hello", "WORLD", "McDonald",
+    "iPhone", "ABC123", "e-Mail", "3.14"};
+
+  std::mt19937 generator(42);
+  for (size_t i = 0; i < 64; ++i) {
+    Tokenizer::Options options;
+    options.mode = (i & 1) ? Tokenizer::Mode::Aggressive : Tokenizer::Mode::Conservative;
+    options.case_markup = (i & 2);
+    options.case_feature = !options.case_markup;
+    options.joiner_annotate = (i & 4);
+    options.segment_case = (i & 8) || options.case_markup;
+    options.segment_alphabet_change = (i & 16);
+    options.allow_isolated_marks = (i & 32);
+    options.preserve_placeholders = (i & 4);
+    options.support_prior_joiners = (i & 16);
+    options.no_substitution = (i & 32);
+
+    const Tokenizer tokenizer(options);
+    options.lang = "en";
+    const Tokenizer reference(options);
+
+    for (size_t j = 0; j < 50; ++j) {
+      std::string text;
+      const size_t num_pieces = generator() % 30;
+      for (size_t k = 0; k < num_pieces; ++k)
+        text += pieces[generator() % pieces.size()];
+
+      std::vector<Token> tokens;
+      std::vector<Token> expected_tokens;
+      tokenizer.tokenize(text, tokens);
+      reference.tokenize(text, expected_tokens);
+      ASSERT_EQ(tokens.size(), expected_tokens.size()) << text;
+      for (size_t t = 0; t < tokens.size(); ++t) {
+        EXPECT_EQ(tokens[t].surface, expected_tokens[t].surface) << text;
+        EXPECT_EQ(tokens[t].casing, expected_tokens[t].casing) << text;
+        EXPECT_EQ(tokens[t].join_left, expected_tokens[t].join_left) << text;
+        EXPECT_EQ(tokens[t].join_right, expected_tokens[t].join_right) << text;
+        EXPECT_EQ(tokens[t].preserve, expected_tokens[t].preserve) << text;
+      }
+    }
+  }
+}
+
 TEST(TokenizerTest, SegmentCase) {
   Tokenizer::Options options;
   options.case_feature = true;
@@ -890,6 +1038,178 @@ TEST(TokenizerTest, BPEDropout) {
   test_tok(tokenizer, "seulement", "seulement", /*detokenize=*/false, /*training=*/false);
 }
 
+TEST(TokenizerTest, BPEMergesMatchReference) {
+  // Each line contains a model, a word, and the pieces produced by the original
+  // quadratic merge loop.
+  std::ifstream reference(get_data("bpe-models/encode-reference.txt"));
+  ASSERT_TRUE(reference.good());
+  std::unordered_map<std::string, std::unique_ptr<BPE>> models;
+  std::string line;
+  size_t num_checked = 0;
+  while (std::getline(reference, line)) {
+    const size_t model_end = line.find('\t');
+    const size_t word_end = line.find('\t', model_end + 1);
+    const std::string model = line.substr(0, model_end);
+    const std::string word = line.substr(model_end + 1, word_end - model_end - 1);
+    const std::string expected = line.substr(word_end + 1);
+
+    auto& bpe = models[model];
+    if (!bpe)
+      bpe = std::make_unique<BPE>(get_data("bpe-models/" + model));
+    EXPECT_EQ(write_tokens(bpe->encode(word, /*training=*/false), {}), expected)
+      << "with model " << model;
+    ++num_checked;
+  }
+  EXPECT_GT(num_checked, 0);
+}
+
+TEST(TokenizerTest, BPECompiledModelMatchesTextModel) {
+  const std::vector<std::string> models = {
+    "codes_bothfix.fr",
+    "codes_prefix.fr",
+    "codes_suffix_case_insensitive.fr",
+    "fr500",
+    "bpe_code.v0.2",
+  };
+  const std::vector<std::string> words = {
+    "seulement",
+    "Seulement",
+    "nonseulement",
+    "anticonstitutionnellement",
+    "welle",
+    "Grün",
+  };
+  const TemporaryFile compiled_file("bpe-compiled-model.bin");
+  const std::string& compiled_path = compiled_file.path();
+  for (const auto& model : models) {
+    const BPE text_bpe(get_data("bpe-models/" + model));
+    text_bpe.save_compiled_model(compiled_path);
+    const BPE compiled_bpe(compiled_path);
+    for (const auto& word : words)
+      EXPECT_EQ(compiled_bpe.encode(word, /*training=*/false),
+                text_bpe.encode(word, /*training=*/false))
+        << "with model " << model << " and word " << word;
+  }
+
+  // The vocabulary restriction uses the reverse merges from the compiled model.
+  Tokenizer::Options options;
+  options.mode = Tokenizer::Mode::Space;
+  options.joiner = "@@";
+  options.joiner_annotate = true;
+  BPE(get_data("bpe-models/bpe_code.v0.2")).save_compiled_model(compiled_path);
+  auto bpe = std::make_shared<BPE>(compiled_path);
+  bpe->load_vocabulary(get_data("bpe-models/vocab.en"), 50, &options);
+  Tokenizer tokenizer(options, bpe);
+  test_tok(tokenizer, "Oliver Grün , welle", "Oliver Gr@@ ü@@ n , wel@@ le");
+}
+
+// Calls function(path) on copies of a binary file where each 4 bytes word is overwritten
+// with a few values, and on truncated copies.
+template <typename Function>
+static void for_each_corrupted_file(const std::string& path, const Function& function) {
+  std::string data;
+  {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream content;
+    content << in.rdbuf();
+    data = content.str();
+  }
+
+  const TemporaryFile corrupted_file("corrupted.bin");
+  const std::string& corrupted_path = corrupted_file.path();
+  const auto check = [&](const std::string& corrupted_data) {
+    {
+      std::ofstream out(corrupted_path, std::ios::binary);
+      out.write(corrupted_data.data(), corrupted_data.size());
+    }
+    function(corrupted_path);
+  };
+
+  for (size_t offset = 0; offset + 4 <= data.size(); offset += 4) {
+    for (const uint32_t value : {0x00000000u, 0x7FFFFFFFu, 0xFFFFFFFFu}) {
+      std::string corrupted_data = data;
+      std::memcpy(&corrupted_data[offset], &value, sizeof (value));
+      check(corrupted_data);
+    }
+  }
+  for (const size_t size : {size_t(0), size_t(8), data.size() / 2, data.size() - 8})
+    check(data.substr(0, size));
+}
+
+TEST(TokenizerTest, BPECompiledModelCorrupted) {
+  const TemporaryFile text_file("bpe-model.txt");
+  const TemporaryFile compiled_file("bpe-model.bin");
+  {
+    std::ofstream text_model(text_file.path());
+    text_model << "#version: 0.2\na b\nab c</w>\n";
+  }
+  BPE(text_file.path()).save_compiled_model(compiled_file.path());
+
+  // Invalid models are rejected when loaded, and accepted models can be used.
+  size_t num_rejected = 0;
+  for_each_corrupted_file(compiled_file.path(), [&num_rejected](const std::string& path) {
+    try {
+      const BPE bpe(path);
+      for (const std::string word : {"abc", "cab", "abab", "x"})
+        bpe.encode(word, /*training=*/false);
+    } catch (const std::invalid_argument&) {
+      ++num_rejected;
+    }
+  });
+  EXPECT_GT(num_rejected, 0);
+}
+
+TEST(TokenizerTest, SubwordCache) {
+  Tokenizer::Options options;
+  options.joiner_annotate = true;
+  options.case_feature = true;
+  const std::string model_path = get_data("bpe-models/codes_suffix_case_insensitive.fr");
+  auto bpe = std::make_shared<BPE>(model_path);
+  auto cached_bpe = std::make_shared<BPE>(model_path);
+  cached_bpe->set_cache_size(2);
+  Tokenizer tokenizer(options, bpe);
+  Tokenizer cached_tokenizer(options, cached_bpe);
+
+  const std::string text = "Seulement seulement, anticonstitutionnellement SEULEMENT seulement.";
+  for (int i = 0; i < 2; ++i) {
+    std::vector<std::string> expected;
+    std::vector<std::string> tokens;
+    tokenizer.tokenize(text, expected);
+    cached_tokenizer.tokenize(text, tokens);
+    EXPECT_EQ(tokens, expected);
+  }
+
+  const auto stats = cached_bpe->get_cache_stats();
+  EXPECT_EQ(stats.hits + stats.misses, 14);
+  EXPECT_GT(stats.hits, 0);
+  EXPECT_GT(stats.misses, 0);
+
+  // The cache is not used when merges are sampled.
+  std::vector<std::string> tokens;
+  cached_bpe->set_dropout(0.1);
+  cached_tokenizer.tokenize(text, tokens, /*training=*/true);
+  EXPECT_EQ(cached_bpe->get_cache_stats().hits + cached_bpe->get_cache_stats().misses, 14);
+}
+
+TEST(TokenizerTest, BPEDropoutMergesMatchDefaultMerges) {
+  // With a negligible dropout, the merge loop used for BPE dropout should produce
+  // the same pieces as the default merge queue.
+  const std::vector<std::string> words = {
+    "seulement",
+    "nonseulement",
+    "Verdun",
+    "improvement",
+    "https://www.example.com/seulement/improvement?query=welle&lang=fr",
+  };
+  for (const std::string model : {"codes_bothfix.fr", "codes_prefix.fr", "fr500"}) {
+    BPE bpe(get_data("bpe-models/" + model));
+    BPE bpe_dropout(get_data("bpe-models/" + model), 1e-7);
+    for (const auto& word : words)
+      EXPECT_EQ(bpe_dropout.encode(word, /*training=*/true), bpe.encode(word, /*training=*/false))
+        << "with model " << model;
+  }
+}
+
 TEST(TokenizerTest, BPEVocabularyWithTrailingJoiner) {
   Tokenizer::Options options;
   options.mode = Tokenizer::Mode::Space;
@@ -1125,6 +1445,802 @@ TEST(TokenizerTest, TokenInterface) {
   EXPECT_EQ(tokenizer.detokenize(tokens), text);
 }
 
+static void test_token_batch(const Tokenizer& tokenizer, const std::string& text) {
+  std::vector<Token> expected;
+  tokenizer.tokenize(text, expected);
+  TokenBatch batch;
+  tokenizer.tokenize(text, batch);
+  EXPECT_EQ(batch.to_tokens(), expected) << "with text " << text;
+}
+
+TEST(TokenizerTest, TokenBatch) {
+  const std::vector<std::string> texts = {
+    "Hello World!",
+    "It costs £2,000.",
+    "a\tb\x01" "c ｟a b｠d ▁e￭f \xff",
+    "Grüßen 测试 ｟ph｠ 42.",
+    "a￨A1 b￨B1￨B2 c\xff d￨D\xff" "1",
+  };
+
+  Tokenizer::Options options;
+  options.joiner_annotate = true;
+  Tokenizer conservative(options);
+  options.mode = Tokenizer::Mode::Space;
+  Tokenizer space(options);
+  options.mode = Tokenizer::Mode::Aggressive;
+  options.joiner_annotate = false;
+  options.case_markup = true;
+  options.spacer_annotate = true;
+  Tokenizer aggressive(options);
+  Tokenizer bpe(Tokenizer::Options(),
+                std::make_shared<BPE>(get_data("bpe-models/codes_suffix_case_insensitive.fr")));
+  for (const auto& text : texts) {
+    test_token_batch(conservative, text);
+    test_token_batch(space, text);
+    test_token_batch(aggressive, text);
+    test_token_batch(bpe, text);
+  }
+
+  // Unmodified tokens are views on the text.
+  const std::string text = "Hello ｟ph｠ W\x01orld!";
+  TokenBatch batch;
+  conservative.tokenize(text, batch);
+  ASSERT_EQ(batch.size(), 4);
+  EXPECT_EQ(batch[0].surface.data(), text.data());
+  EXPECT_EQ(batch[1].surface.data(), text.data() + 6);
+  EXPECT_EQ(batch[2].surface, "World");
+  EXPECT_EQ(batch[3].surface.data(), text.data() + text.size() - 1);
+  EXPECT_TRUE(batch[1].is_placeholder());
+}
+
+TEST(TokenizerTest, TokenizationWorkspaceNoAllocations) {
+  Tokenizer::Options options;
+  options.mode = Tokenizer::Mode::Aggressive;
+  options.joiner_annotate = true;
+  Tokenizer tokenizer(options);
+  const std::string text = "Hello World! It costs £2,000 (▁ and ￭ are substituted).";
+  std::vector<Token> expected;
+  tokenizer.tokenize(text, expected);
+
+  TokenizationWorkspace workspace;
+  TokenBatch batch;
+  tokenizer.tokenize(text, batch, workspace);
+  tokenizer.tokenize(text, batch);
+
+  const size_t allocations_before = num_allocations;
+  for (int i = 0; i < 10; ++i) {
+    tokenizer.tokenize(text, batch, workspace);
+    tokenizer.tokenize(text, batch);  // With the thread workspace.
+  }
+  EXPECT_EQ(num_allocations - allocations_before, 0);
+  EXPECT_EQ(batch.to_tokens(), expected);
+}
+
+TEST(TokenizerTest, TokenizeBatch) {
+  Tokenizer::Options options;
+  options.mode = Tokenizer::Mode::Aggressive;
+  options.joiner_annotate = true;
+  options.case_feature = true;
+  Tokenizer tokenizer(options);
+
+  std::vector<std::string> texts;
+  for (size_t i = 0; i < 200; ++i)
+    texts.emplace_back(i % 7 == 0 ? std::string(i * 10, 'a') : "Hello World " + std::to_string(i));
+
+  for (const size_t num_threads : {1, 4}) {
+    std::vector<std::vector<std::string>> words;
+    std::vector<std::vector<std::vector<std::string>>> features;
+    std::vector<std::vector<Token>> tokens;
+    tokenizer.tokenize_batch(texts, words, features, num_threads);
+    tokenizer.tokenize_batch(texts, tokens, num_threads);
+    ASSERT_EQ(words.size(), texts.size());
+    ASSERT_EQ(features.size(), texts.size());
+    ASSERT_EQ(tokens.size(), texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+      std::vector<std::string> expected_words;
+      std::vector<std::vector<std::string>> expected_features;
+      tokenizer.tokenize(texts[i], expected_words, expected_features);
+      EXPECT_EQ(words[i], expected_words);
+      EXPECT_EQ(features[i], expected_features);
+      std::vector<Token> expected_tokens;
+      tokenizer.tokenize(texts[i], expected_tokens);
+      EXPECT_EQ(tokens[i], expected_tokens);
+    }
+  }
+}
+
+TEST(TokenizerTest, TokenizeToIds) {
+  const std::string text = "Hello World! ｟Ph｠ It's 2023, THE END.";
+  std::vector<Tokenizer::Options> options_list(5);
+  options_list[0].mode = Tokenizer::Mode::Aggressive;
+  options_list[0].joiner_annotate = true;
+  options_list[1].mode = Tokenizer::Mode::Aggressive;
+  options_list[1].joiner_annotate = true;
+  options_list[1].joiner_new = true;
+  options_list[1].case_markup = true;
+  options_list[2].mode = Tokenizer::Mode::Conservative;
+  options_list[2].spacer_annotate = true;
+  options_list[2].case_feature = true;
+  options_list[3].mode = Tokenizer::Mode::Space;
+  options_list[4].mode = Tokenizer::Mode::None;
+  options_list[4].spacer_annotate = true;
+  options_list[4].spacer_new = true;
+
+  for (auto& options : options_list) {
+    Tokenizer tokenizer(options);
+    std::vector<std::string> words;
+    std::vector<std::vector<std::string>> features;
+    tokenizer.tokenize(text, words, features);
+
+    Vocab vocab({"<unk>"});
+    for (size_t i = 0; i < words.size(); i += 2)
+      vocab.add_token(words[i]);
+    const FrozenVocab frozen_vocab(vocab);
+
+    std::vector<int32_t> expected_ids;
+    for (const auto& word : words)
+      expected_ids.emplace_back(vocab.lookup(word));
+
+    std::vector<int32_t> ids;
+    tokenizer.tokenize_to_ids(text, vocab, ids);
+    EXPECT_EQ(ids, expected_ids);
+    ids.clear();
+    tokenizer.tokenize_to_ids(text, frozen_vocab, ids);
+    EXPECT_EQ(ids, expected_ids);
+  }
+}
+
+TEST(TokenizerTest, TokenizeBatchToIds) {
+  Tokenizer tokenizer(Tokenizer::Mode::Space);
+  Vocab vocab({"<blank>", "<unk>"});
+  vocab.add_from_text("a b c");
+  const FrozenVocab frozen_vocab(vocab);
+  const std::vector<std::string> texts = {"a b", "", "c d a b"};
+  const std::vector<int32_t> expected_ids = {
+    2, 3, 0, 0,
+    0, 0, 0, 0,
+    4, 1, 2, 3,
+  };
+  const std::vector<size_t> expected_lengths = {2, 0, 4};
+
+  for (const size_t num_threads : {1, 2}) {
+    std::vector<int32_t> ids;
+    std::vector<size_t> lengths;
+    tokenizer.tokenize_batch_to_ids(texts, vocab, ids, lengths, 0, num_threads);
+    EXPECT_EQ(ids, expected_ids);
+    EXPECT_EQ(lengths, expected_lengths);
+    tokenizer.tokenize_batch_to_ids(texts, frozen_vocab, ids, lengths, 0, num_threads);
+    EXPECT_EQ(ids, expected_ids);
+    EXPECT_EQ(lengths, expected_lengths);
+  }
+}
+
+TEST(TokenizerTest, TokenizeStream) {
+  Tokenizer::Options options;
+  options.mode = Tokenizer::Mode::Aggressive;
+  options.joiner_annotate = true;
+  Tokenizer tokenizer(options);
+
+  std::string input;
+  std::string expected;
+  for (size_t i = 0; i < 5000; ++i) {
+    std::string line;
+    if (i == 100)
+      line = std::string(100000, 'a') + " b";  // Longer than a read block.
+    else if (i % 10 != 0)
+      line = "Hello World! " + std::to_string(i);
+    input += line;
+    if (i + 1 < 5000)  // No newline after the last line.
+      input += '\n';
+    std::vector<std::string> words;
+    tokenizer.tokenize(line, words);
+    expected += write_tokens(words, {}) + '\n';
+  }
+
+  for (const size_t num_threads : {1, 2, 4}) {
+    for (const size_t buffer_size : {1, 7, 1000}) {
+      std::istringstream in(input);
+      std::ostringstream out;
+      tokenizer.tokenize_stream(in, out, num_threads, false, true, " ", buffer_size);
+      EXPECT_EQ(out.str(), expected);
+    }
+  }
+}
+
+TEST(TokenizerTest, DetokenizeStream) {
+  Tokenizer::Options options;
+  options.mode = Tokenizer::Mode::Aggressive;
+  options.joiner_annotate = true;
+  Tokenizer tokenizer(options);
+
+  std::string input;
+  std::string expected;
+  for (size_t i = 0; i < 5000; ++i) {
+    std::vector<std::string> words;
+    if (i % 10 != 0)
+      tokenizer.tokenize("Hello World! " + std::to_string(i), words);
+    input += write_tokens(words, {}) + '\n';
+    expected += tokenizer.detokenize(words) + '\n';
+  }
+
+  for (const size_t num_threads : {1, 2, 4}) {
+    for (const size_t buffer_size : {1, 7, 1000}) {
+      std::istringstream in(input);
+      std::ostringstream out;
+      tokenizer.detokenize_stream(in, out, " ", num_threads, buffer_size);
+      EXPECT_EQ(out.str(), expected);
+    }
+  }
+}
+
+// Input stream that gives one line at a time, like an interactive terminal. Before giving
+// the next line, it checks that the previous lines were written to the output.
+class InteractiveInputBuffer : public std::streambuf {
+public:
+  InteractiveInputBuffer(std::vector<std::string> lines, const std::ostringstream& output)
+    : _lines(std::move(lines))
+    , _output(output)
+  {
+  }
+
+protected:
+  int_type underflow() override {
+    if (_next_line == _lines.size())
+      return traits_type::eof();
+    const std::string output = _output.str();
+    EXPECT_EQ(std::count(output.begin(), output.end(), '\n'), _next_line);
+    _current = _lines[_next_line++] + '\n';
+    setg(&_current[0], &_current[0], &_current[0] + _current.size());
+    return traits_type::to_int_type(_current[0]);
+  }
+
+private:
+  const std::vector<std::string> _lines;
+  const std::ostringstream& _output;
+  size_t _next_line = 0;
+  std::string _current;
+};
+
+TEST(TokenizerTest, TokenizeStreamInteractive) {
+  Tokenizer::Options options;
+  options.mode = Tokenizer::Mode::Conservative;
+  options.joiner_annotate = true;
+  Tokenizer tokenizer(options);
+
+  std::ostringstream out;
+  InteractiveInputBuffer buffer({"Hello World!", "", "It costs £2,000."}, out);
+  std::istream in(&buffer);
+  tokenizer.tokenize_stream(in, out);
+  EXPECT_EQ(out.str(), "Hello World ￭!\n\nIt costs £￭ 2,000 ￭.\n");
+}
+
+TEST(TokenizerTest, TokenizeFile) {
+  Tokenizer::Options options;
+  options.mode = Tokenizer::Mode::Aggressive;
+  options.joiner_annotate = true;
+  Tokenizer tokenizer(options);
+
+  const TemporaryFile input_file("input.txt");
+  const TemporaryFile output_file("output.txt");
+  const std::string& input_path = input_file.path();
+  const std::string& output_path = output_file.path();
+  const std::string input = "Hello World!\n\nIt costs £2,000.\nNo newline at the end";
+  {
+    std::ofstream input_stream(input_path);
+    input_stream << input;
+  }
+
+  std::istringstream in(input);
+  std::ostringstream expected;
+  tokenizer.tokenize_stream(in, expected);
+
+  for (const size_t num_threads : {1, 2}) {
+    tokenizer.tokenize_file(input_path, output_path, num_threads, false, true, " ", 2);
+    std::ifstream output_stream(output_path);
+    std::ostringstream output;
+    output << output_stream.rdbuf();
+    EXPECT_EQ(output.str(), expected.str());
+  }
+
+  const TemporaryFile missing_file("missing.txt");
+  EXPECT_THROW(tokenizer.tokenize_file(missing_file.path(), output_path), std::invalid_argument);
+}
+
+// Run with --gtest_also_run_disabled_tests to print the tokenize_stream throughput.
+TEST(TokenizerTest, DISABLED_TokenizeStreamThroughput) {
+  Tokenizer::Options options;
+  options.mode = Tokenizer::Mode::Aggressive;
+  options.joiner_annotate = true;
+  Tokenizer tokenizer(options);
+
+  const size_t num_lines = 1000000;
+  std::string input;
+  for (size_t i = 0; i < num_lines; ++i)
+    input += "Hello World! It costs " + std::to_string(i) + "$.\n";
+
+  const size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (size_t num_threads = 1; num_threads <= max_threads; ++num_threads) {
+    std::istringstream in(input);
+    std::ostringstream out;
+    const auto start = std::chrono::steady_clock::now();
+    tokenizer.tokenize_stream(in, out, num_threads);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "num_threads=" << num_threads
+              << ": " << static_cast<size_t>(num_lines / elapsed.count()) << " lines/s"
+              << std::endl;
+  }
+}
+
+// Options that disable the specialized kernels without changing the tokenization of texts
+// that do not contain placeholders.
+static Tokenizer::Options with_generic_kernel(Tokenizer::Options options) {
+  options.preserve_placeholders = true;
+  return options;
+}
+
+static std::vector<Tokenizer::Options> get_kernel_options() {
+  std::vector<Tokenizer::Options> configurations;
+  for (const auto mode : {Tokenizer::Mode::Conservative,
+                          Tokenizer::Mode::Aggressive,
+                          Tokenizer::Mode::None}) {
+    for (size_t annotation = 0; annotation < 3; ++annotation) {
+      Tokenizer::Options options;
+      options.mode = mode;
+      options.joiner_annotate = (annotation == 1);
+      options.spacer_annotate = (annotation == 2);
+      configurations.emplace_back(options);
+    }
+  }
+  return configurations;
+}
+
+static std::string describe_kernel_options(const Tokenizer::Options& options) {
+  std::string description = Tokenizer::mode_to_str(options.mode);
+  if (options.joiner_annotate)
+    description += "+joiner_annotate";
+  if (options.spacer_annotate)
+    description += "+spacer_annotate";
+  if (options.case_feature)
+    description += "+case_feature";
+  return description;
+}
+
+TEST(TokenizerTest, SpecializedKernels) {
+  const std::vector<std::string> texts = {
+    "Hello World!",
+    "It costs £2,000 at McDonald's in New-York.",
+    "  Ça   coûte\u00A05 € (e-mail: x_y@z.com)  ",
+    "日本語のテキスト。ありがとう",
+    "a\u0301b\u0301 ￭ ▁ ％ ＃ ：",
+  };
+
+  for (auto options : get_kernel_options()) {
+    for (const bool case_feature : {false, true}) {
+      options.case_feature = case_feature;
+      const Tokenizer tokenizer(options);
+      const Tokenizer generic_tokenizer(with_generic_kernel(options));
+      for (const auto& text : texts) {
+        std::vector<std::string> tokens, expected_tokens;
+        std::vector<std::vector<std::string>> features, expected_features;
+        tokenizer.tokenize(text, tokens, features);
+        generic_tokenizer.tokenize(text, expected_tokens, expected_features);
+        EXPECT_EQ(tokens, expected_tokens) << describe_kernel_options(options);
+        EXPECT_EQ(features, expected_features) << describe_kernel_options(options);
+      }
+    }
+  }
+}
+
+TEST(TokenizerTest, TokenizeAndWrite) {
+  const std::vector<std::string> texts = {
+    "",
+    "Hello World!",
+    "It costs £2,000 at McDonald's in New-York.",
+    "  Ça   coûte\u00A05 € (e-mail: x_y@z.com)  ",
+    "Hello￨A World￨B !￨C",
+  };
+
+  auto configurations = get_kernel_options();
+  for (auto options : get_kernel_options()) {
+    options.case_feature = true;
+    configurations.emplace_back(options);
+  }
+  {
+    Tokenizer::Options options;
+    options.mode = Tokenizer::Mode::Aggressive;
+    options.joiner_annotate = true;
+    options.joiner_new = true;
+    options.case_markup = true;
+    configurations.emplace_back(options);
+    options.joiner_annotate = false;
+    options.joiner_new = false;
+    options.spacer_annotate = true;
+    options.spacer_new = true;
+    configurations.emplace_back(options);
+  }
+
+  for (const auto& options : configurations) {
+    const Tokenizer tokenizer(options);
+    for (const auto& text : texts) {
+      for (const std::string delimiter : {" ", "\t"}) {
+        std::vector<std::string> tokens;
+        std::vector<std::vector<std::string>> features;
+        tokenizer.tokenize(text, tokens, features);
+        std::string output = "prefix";
+        tokenizer.tokenize_and_write(text, output, delimiter);
+        EXPECT_EQ(output, "prefix" + write_tokens(tokens, features, delimiter))
+          << describe_kernel_options(options);
+      }
+    }
+  }
+}
+
+TEST(TokenizerTest, SpecializedKernelsAfterOptionsChange) {
+  Tokenizer tokenizer(Tokenizer::Mode::Conservative);
+  tokenizer.add_alphabet_to_segment("Han");
+  std::vector<std::string> tokens;
+  tokenizer.tokenize("测试abc", tokens);
+  EXPECT_EQ(tokens, (std::vector<std::string>{"测", "试abc"}));
+
+  Tokenizer joiner_tokenizer(Tokenizer::Mode::Aggressive, Tokenizer::Flags::JoinerAnnotate);
+  joiner_tokenizer.set_joiner("@@");
+  test_tok(joiner_tokenizer, "Hello, World!", "Hello @@, World @@!");
+  joiner_tokenizer.unset_annotate();
+  test_tok(joiner_tokenizer, "Hello, World!", "Hello , World !");
+}
+
+TEST(TokenizerTest, DISABLED_SpecializedKernelsThroughput) {
+  const size_t num_lines = 200000;
+  std::vector<std::string> lines;
+  lines.reserve(num_lines);
+  for (size_t i = 0; i < num_lines; ++i)
+    lines.emplace_back("Hello World! It costs " + std::to_string(i) + "$ at McDonald's.");
+
+  const auto get_throughput = [&lines](const Tokenizer& tokenizer) {
+    std::vector<std::string> tokens;
+    std::vector<std::vector<std::string>> features;
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& line : lines) {
+      tokens.clear();
+      tokenizer.tokenize(line, tokens, features);
+    }
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    return static_cast<size_t>(lines.size() / elapsed.count());
+  };
+
+  for (const auto& options : get_kernel_options()) {
+    const Tokenizer tokenizer(options);
+    const Tokenizer generic_tokenizer(with_generic_kernel(options));
+    std::cout << describe_kernel_options(options)
+              << ": specialized=" << get_throughput(tokenizer) << " lines/s"
+              << ", generic=" << get_throughput(generic_tokenizer) << " lines/s"
+              << std::endl;
+  }
+}
+
+// Dictionary of random words over a small alphabet with Zipfian frequencies.
+static std::string make_zipfian_dictionary(size_t num_words) {
+  std::string vocab;
+  unsigned int state = 42;
+  for (size_t i = 0; i < num_words; ++i) {
+    const size_t length = 3 + i % 8;
+    for (size_t c = 0; c < length; ++c) {
+      state = state * 1103515245 + 12345;
+      vocab += static_cast<char>('a' + (state >> 16) % 8);
+    }
+    vocab += ' ' + std::to_string(1 + 10000 / (i + 1)) + '\n';
+  }
+  return vocab;
+}
+
+static std::string learn_bpe(const std::string& input,
+                             int symbols,
+                             int min_frequency,
+                             size_t num_threads = 1,
+                             bool dict_input = true,
+                             size_t max_vocab_size = 0) {
+  BPELearner learner(false,
+                     symbols,
+                     min_frequency,
+                     dict_input,
+                     false,
+                     num_threads,
+                     max_vocab_size);
+  std::istringstream in(input);
+  learner.ingest(in);
+  std::ostringstream model;
+  learner.learn(model);
+  return model.str();
+}
+
+TEST(BPELearnerTest, NumThreadsDoesNotChangeMerges) {
+  // Enough words to split the statistics updates between threads.
+  const std::string vocab = make_zipfian_dictionary(5000);
+  const std::string expected = learn_bpe(vocab, 300, 2);
+  EXPECT_EQ(learn_bpe(vocab, 300, 2, 2), expected);
+  EXPECT_EQ(learn_bpe(vocab, 300, 2, 8), expected);
+}
+
+TEST(BPELearnerTest, ParallelIngestion) {
+  // The vocabulary is also reduced at the same points with multiple threads.
+  const std::string text = make_zipfian_dictionary(30000);
+  for (const size_t max_vocab_size : {0, 300}) {
+    const std::string expected = learn_bpe(text, 200, 2, 1, false, max_vocab_size);
+    EXPECT_EQ(learn_bpe(text, 200, 2, 3, false, max_vocab_size), expected);
+  }
+}
+
+TEST(BPELearnerTest, MaxVocabSize) {
+  // The rare words are removed from the vocabulary when it is full.
+  std::string text;
+  std::string frequent_text;
+  for (size_t i = 0; i < 100; ++i) {
+    text += "hello world rare" + std::to_string(i) + '\n';
+    frequent_text += "hello world\n";
+  }
+
+  const std::string model = learn_bpe(text, 20, 50, 1, false, 10);
+  EXPECT_EQ(model, learn_bpe(frequent_text, 20, 50, 1, false, 0));
+  EXPECT_NE(model, learn_bpe(text, 20, 50, 1, false, 0));
+}
+
+TEST(BPELearnerTest, MaxVocabSizeKeepsMostFrequentWords) {
+  EXPECT_EQ(learn_bpe("ab 2147483647\ncd 2147483647\nef 2147483646\ngh 1\nij 1\n",
+                      10, 1, 1, true, 4),
+            "#version: 0.2\na b</w>\nc d</w>\ne f</w>\n");
+  // Ties are broken on the words.
+  EXPECT_EQ(learn_bpe("ef 5\ncd 5\nab 5\n", 10, 1, 1, true, 2),
+            "#version: 0.2\na b</w>\n");
+}
+
+TEST(BPELearnerTest, TiesAreBrokenOnSymbols) {
+  EXPECT_EQ(learn_bpe("cd 5\nab 5\nef 4\n", 10, 1),
+            "#version: 0.2\na b</w>\nc d</w>\ne f</w>\n");
+}
+
+// Run with --gtest_also_run_disabled_tests to print the learning time.
+TEST(BPELearnerTest, DISABLED_LearnZipfianDictionary) {
+  const std::string vocab = make_zipfian_dictionary(200000);
+  const size_t max_threads = std::max(std::thread::hardware_concurrency(), 1u);
+  for (const size_t num_threads : {size_t(1), max_threads}) {
+    const auto start = std::chrono::steady_clock::now();
+    learn_bpe(vocab, 20000, 2, num_threads);
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "num_threads=" << num_threads << ": " << elapsed.count() << "s" << std::endl;
+    if (max_threads == 1)
+      break;
+  }
+}
+
+static void check_in_memory_training(const std::string& options) {
+  const std::vector<std::string> sentences = {
+    "The quick brown fox jumps over the lazy dog.",
+    "Pack my box with five dozen liquor jugs.",
+    "How vexingly quick daft zebras jump!",
+    "The five boxing wizards jump quickly.",
+    "Sphinx of black quartz, judge my vow.",
+  };
+
+  const TemporaryFile input_file("input.txt");
+  const TemporaryFile model_prefix("reference");
+  const TemporaryFile model_file(model_prefix, ".model");
+  const TemporaryFile vocab_file(model_prefix, ".vocab");
+  {
+    std::ofstream input(input_file.path());
+    for (size_t i = 0; i < 20; ++i)
+      for (const auto& sentence : sentences)
+        input << sentence << '\n';
+  }
+  const auto status = sentencepiece::SentencePieceTrainer::Train(
+    options + " --input=" + input_file.path() + " --model_prefix=" + model_prefix.path());
+  ASSERT_TRUE(status.ok());
+
+  SentencePieceLearner learner(false, options);
+  for (size_t i = 0; i < 20; ++i)
+    for (const auto& sentence : sentences)
+      learner.ingest(sentence);
+  std::ostringstream model;
+  learner.learn(model);
+
+  sentencepiece::SentencePieceProcessor reference;
+  sentencepiece::SentencePieceProcessor processor;
+  ASSERT_TRUE(reference.Load(model_file.path()).ok());
+  ASSERT_TRUE(processor.LoadFromSerializedProto(model.str()).ok());
+
+  ASSERT_EQ(processor.GetPieceSize(), reference.GetPieceSize());
+  for (int i = 0; i < reference.GetPieceSize(); ++i) {
+    EXPECT_EQ(processor.IdToPiece(i), reference.IdToPiece(i));
+    EXPECT_EQ(processor.GetScore(i), reference.GetScore(i));
+  }
+}
+
+TEST(SentencePieceLearnerTest, InMemoryTrainingMatchesFileTraining) {
+  check_in_memory_training("--vocab_size=60 --character_coverage=1 --num_threads=1");
+}
+
+TEST(SentencePieceLearnerTest, InMemoryTrainingMatchesFileTrainingBPE) {
+  // The sentences are deduplicated for this model type.
+  check_in_memory_training(
+    "--vocab_size=60 --character_coverage=1 --num_threads=1 --model_type=bpe");
+}
+
+TEST(SentencePieceLearnerTest, ParallelIngestion) {
+  std::vector<std::string> lines;
+  for (size_t i = 0; i < 1000; ++i)
+    lines.emplace_back("sentence " + std::to_string(i % 37) + " with a\ttab");
+
+  // The unigram input is saved as ingested, the BPE input in the TSV format with one
+  // line per unique sentence.
+  const std::vector<std::pair<std::string, std::string>> cases = {
+    {"--vocab_size=30", "sentence 0 with a\ttab"},
+    {"--vocab_size=30 --model_type=bpe", "sentence 0 with a tab\t28"},
+  };
+
+  for (const auto& test_case : cases) {
+    std::vector<std::string> models;
+    for (const size_t num_threads : {1, 4}) {
+      const TemporaryFile input_file("input.txt");
+      SentencePieceLearner learner(false,
+                                   test_case.first,
+                                   input_file.path(),
+                                   false,
+                                   true,
+                                   num_threads);
+      learner.ingest(lines);
+      std::ostringstream model;
+      learner.learn(model);
+      models.emplace_back(model.str());
+
+      std::ifstream input(input_file.path());
+      std::string line;
+      ASSERT_TRUE(static_cast<bool>(std::getline(input, line)));
+      EXPECT_EQ(line, test_case.second);
+    }
+
+    EXPECT_EQ(models[0], models[1]) << test_case.first;
+  }
+}
+
+TEST(VocabTest, Freeze) {
+  Vocab vocab({"<unk>", "<s>"});
+  for (const std::string token : {"b", "a", "b", "c", "b", "a", "d", ""})
+    vocab.add_token(token);
+  vocab.resize(0, 2);
+
+  const FrozenVocab frozen_vocab(vocab);
+  ASSERT_EQ(frozen_vocab.size(), vocab.size());
+  EXPECT_EQ(frozen_vocab.get_default_id(), 0);
+  for (size_t id = 0; id < vocab.size(); ++id) {
+    const std::string& token = vocab.lookup(id);
+    EXPECT_EQ(frozen_vocab.lookup(id), token);
+    EXPECT_EQ(frozen_vocab.lookup(std::string_view(token)), id);
+    EXPECT_EQ(frozen_vocab.counter(id), vocab.counters()[id]);
+  }
+  EXPECT_FALSE(frozen_vocab.contains("c"));
+  EXPECT_EQ(frozen_vocab.lookup(std::string_view("c")), 0);
+  EXPECT_EQ(frozen_vocab.lookup(frozen_vocab.size()), Vocab::unk_token);
+
+  const TemporaryFile file("vocab.bin");
+  frozen_vocab.save(file.path());
+  const FrozenVocab loaded_vocab(file.path());
+  ASSERT_EQ(loaded_vocab.size(), vocab.size());
+  EXPECT_EQ(loaded_vocab.lookup(std::string_view("b")), vocab.lookup("b"));
+  EXPECT_EQ(loaded_vocab.lookup(std::string_view("a")), vocab.lookup("a"));
+}
+
+TEST(VocabTest, Merge) {
+  Vocab vocab({"<unk>"});
+  vocab.add_from_text("a b a");
+  Vocab other({"<s>"});
+  other.add_from_text("c b <unk>");
+  vocab.merge(other);
+
+  const std::vector<std::string> expected_tokens = {"<unk>", "a", "b", "<s>", "c"};
+  EXPECT_EQ(vocab.ids_to_tokens(), expected_tokens);
+  const size_t max_count = std::numeric_limits<size_t>::max();
+  const std::vector<size_t> expected_counters = {max_count, 2, 2, max_count, 1};
+  EXPECT_EQ(vocab.counters(), expected_counters);
+}
+
+TEST(VocabTest, AddFromStreamNumThreads) {
+  std::string text;
+  for (size_t i = 0; i < 25000; ++i)
+    text += "token" + std::to_string(i % 1000) + " Hello World! word" + std::to_string(i) + "\n";
+
+  Tokenizer tokenizer(Tokenizer::Mode::Aggressive, Tokenizer::Flags::JoinerAnnotate);
+  Vocab expected_vocab({"<blank>", "<unk>", "Hello"});
+  std::istringstream expected_input(text);
+  expected_vocab.add_from_stream(expected_input, &tokenizer);
+
+  Vocab vocab({"<blank>", "<unk>", "Hello"});
+  std::istringstream input(text);
+  vocab.add_from_stream(input, &tokenizer, 4);
+
+  EXPECT_EQ(vocab.ids_to_tokens(), expected_vocab.ids_to_tokens());
+  EXPECT_EQ(vocab.counters(), expected_vocab.counters());
+}
+
+TEST(VocabTest, FrozenVocabInvalidFile) {
+  EXPECT_THROW(FrozenVocab(get_data("bpe-models/testcode.v0.1")), std::invalid_argument);
+}
+
+TEST(VocabTest, FrozenVocabCorruptedFile) {
+  Vocab vocab;
+  vocab.add_token("a");
+  const TemporaryFile file("vocab.bin");
+  FrozenVocab(vocab).save(file.path());
+
+  size_t num_rejected = 0;
+  for_each_corrupted_file(file.path(), [&num_rejected](const std::string& corrupted_path) {
+    try {
+      const FrozenVocab frozen_vocab(corrupted_path);
+      frozen_vocab.lookup(std::string_view("a"));
+      frozen_vocab.lookup(std::string_view("missing"));
+      for (size_t id = 0; id < frozen_vocab.size(); ++id)
+        frozen_vocab.lookup(id);
+    } catch (const std::invalid_argument&) {
+      ++num_rejected;
+    }
+  });
+  EXPECT_GT(num_rejected, 0);
+}
+
+TEST(UnicodeTest, GetCharactersInfo) {
+  // ASCII runs, 2 bytes characters, characters decoded by ICU, an invalid byte,
+  // and an embedded null character which ends the iteration.
+  std::string text = "Hello world, this is ASCII: 42! \xff\xc3\xa9t\xc3\x89 \xce\xb1 \xcc\x81\xe4\xb8\xad\xf0\x9f\x98\x80";
+  text += '\0';
+  text += "ignored";
+  const auto chars = unicode::get_characters_info(text);
+  std::string characters;
+  for (const auto& c : chars) {
+    characters.append(c.data, c.length);
+    EXPECT_EQ(c.value, unicode::utf8_to_cp(c.data));
+    EXPECT_EQ(c.char_type, unicode::get_char_type(c.value));
+    EXPECT_EQ(c.case_type, unicode::get_case_v2(c.value));
+  }
+  EXPECT_EQ(characters, "Hello world, this is ASCII: 42! \xc3\xa9t\xc3\x89 \xce\xb1 \xcc\x81\xe4\xb8\xad\xf0\x9f\x98\x80");
+
+  const auto check = [&chars](size_t index,
+                              unicode::code_point_t value,
+                              unicode::CharType char_type,
+                              unicode::CaseType case_type) {
+    EXPECT_EQ(chars[index].value, value);
+    EXPECT_EQ(chars[index].char_type, char_type);
+    EXPECT_EQ(chars[index].case_type, case_type);
+  };
+  check(0, 'H', unicode::CharType::Letter, unicode::CaseType::Upper);
+  check(1, 'e', unicode::CharType::Letter, unicode::CaseType::Lower);
+  check(5, ' ', unicode::CharType::Separator, unicode::CaseType::None);
+  check(11, ',', unicode::CharType::Other, unicode::CaseType::None);
+  check(28, '4', unicode::CharType::Number, unicode::CaseType::None);
+  check(32, 0xE9, unicode::CharType::Letter, unicode::CaseType::Lower);
+  check(34, 0xC9, unicode::CharType::Letter, unicode::CaseType::Upper);
+  check(36, 0x3B1, unicode::CharType::Letter, unicode::CaseType::Lower);
+  check(38, 0x301, unicode::CharType::Mark, unicode::CaseType::None);
+  check(39, 0x4E2D, unicode::CharType::Letter, unicode::CaseType::None);
+  check(40, 0x1F600, unicode::CharType::Other, unicode::CaseType::None);
+  EXPECT_EQ(chars.size(), 41);
+}
+
+TEST(UnicodeTest, GetScript) {
+  const int latin = unicode::get_script_code("Latin");
+  const int han = unicode::get_script_code("Han");
+  const int hiragana = unicode::get_script_code("Hiragana");
+  EXPECT_EQ(unicode::get_script('a'), latin);
+  EXPECT_EQ(unicode::get_script(0x4E2D), han);
+  // Inherited characters take the previous script.
+  EXPECT_EQ(unicode::get_script(0x301, latin), latin);
+  EXPECT_EQ(unicode::get_script(0x301, -1), -1);
+  // Common characters take the previous script if it is in their script extensions.
+  EXPECT_EQ(unicode::get_script(0x3001, hiragana), hiragana);
+  EXPECT_EQ(unicode::get_script(0x3001, latin), unicode::get_script(0x3001));
+  EXPECT_EQ(unicode::get_script(',', latin), unicode::get_script(','));
+  // Scripts kept for backward compatibility.
+  EXPECT_STREQ(unicode::get_script_name(unicode::get_script(0x2F00)), "Kangxi");
+  EXPECT_STREQ(unicode::get_script_name(unicode::get_script(0x3190)), "Kanbun");
+}
+
 int main(int argc, char *argv[]) {
   testing::InitGoogleTest(&argc, argv);
   assert(argc == 2);